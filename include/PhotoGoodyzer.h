@@ -1,9 +1,17 @@
 /// This is an "include everything" file for convenience.
 
+#include "PhotoGoodyzer/Allocator.h"
 #include "PhotoGoodyzer/Array.h"
 #include "PhotoGoodyzer/ArrayBase.h"
+#include "PhotoGoodyzer/ArrayView.h"
 #include "PhotoGoodyzer/Channel.h"
 #include "PhotoGoodyzer/ColorSpace.h"
+#include "PhotoGoodyzer/FFTPlans.h"
 #include "PhotoGoodyzer/Image.h"
+#include "PhotoGoodyzer/Layout.h"
+#include "PhotoGoodyzer/Math.h"
 #include "PhotoGoodyzer/ops.h"
+#include "PhotoGoodyzer/Parallel.h"
+#include "PhotoGoodyzer/QuantileSketch.h"
+#include "PhotoGoodyzer/Reductions.h"
 #include "PhotoGoodyzer/sRGBvLinRGB.h"
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace pg {
+
+/// Default alignment of data arrays allocated by the library, in bytes: the size of a cache line
+/// and of an AVX-512 register.
+inline constexpr std::size_t ARRAY_ALIGNMENT = 64;
+
+/// Interface of memory resources used by Array, Channel and Image to allocate their data arrays.
+///
+/// Derive from the class to plug in pooling, NUMA placement, etc. A resource must outlive all
+/// arrays allocated from it and be safe to use from several threads.
+class MemoryResource {
+public:
+    virtual ~MemoryResource() = default;
+
+    /// Allocates at least bytes of memory aligned to alignment (a power of two); throws
+    /// std::bad_alloc on failure.
+    virtual void* Allocate(std::size_t bytes, std::size_t alignment) = 0;
+
+    /// Releases memory returned by Allocate() called with the same bytes and alignment.
+    virtual void Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) = 0;
+};
+
+/// Memory resource allocating aligned buffers from the global heap.
+///
+/// Buffers of at least huge_page_threshold bytes are aligned to 2 MiB, and transparent huge pages
+/// are requested for them (Linux only; ignored elsewhere).
+class AlignedResource : public MemoryResource {
+private:
+    std::size_t huge_page_threshold_;
+
+public:
+    /// Size of a transparent huge page on x86-64 and AArch64 Linux
+    static constexpr std::size_t HUGE_PAGE_SIZE = std::size_t(2) << 20;
+
+    /// @param huge_page_threshold Minimal size of buffers backed by transparent huge pages;
+    /// 0 disables huge pages.
+    explicit AlignedResource(std::size_t huge_page_threshold = 0);
+
+    void* Allocate(std::size_t bytes, std::size_t alignment) override;
+    void Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override;
+
+private:
+    std::size_t ActualAlignment(std::size_t bytes, std::size_t alignment) const;
+};
+
+/// Memory resource for temporaries of image pipelines which keeps released buffers and hands them
+/// out again instead of returning them to the upstream resource.
+///
+/// Processing a batch of same-sized images allocates the same set of full-resolution buffers for
+/// every image; with an arena only the first image pays for allocations and page faults. Buffers
+/// are recycled by exact (size, alignment) match. Cached buffers are freed by Release() or at
+/// destruction; the arena must outlive every array allocated from it. The arena is thread-safe.
+/// @see ScopedResource
+class ScratchArena : public MemoryResource {
+private:
+    MemoryResource* upstream_;
+    std::mutex mutex_;
+    std::map<std::pair<std::size_t, std::size_t>, std::vector<void*>> cached_;
+    std::size_t cached_bytes_ = 0;
+
+public:
+    /// @param upstream Resource used for the buffers which are not cached yet; nullptr means
+    /// GetDefaultResource() at the moment of construction.
+    explicit ScratchArena(MemoryResource* upstream = nullptr);
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    ~ScratchArena() override;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment) override;
+    void Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override;
+
+    /// Returns all cached buffers to the upstream resource.
+    void Release();
+
+    /// Returns the total size of the cached buffers in bytes.
+    std::size_t GetCachedBytes();
+};
+
+/// Returns the resource used by arrays constructed without an explicit resource: the innermost
+/// ScopedResource of the calling thread if any, otherwise the one set by SetDefaultResource() or
+/// an AlignedResource without huge pages.
+MemoryResource* GetDefaultResource();
+
+/// Sets the resource used by arrays constructed without an explicit resource; nullptr restores
+/// the built-in one. Arrays allocated before the call keep using their resources.
+void SetDefaultResource(MemoryResource* resource);
+
+/// Makes a resource the default one for the calling thread during the lifetime of the object, so
+/// all temporaries of operations called in the scope are allocated from it.
+///
+/// Example:
+/// @code
+/// pg::ScratchArena arena;
+/// for (auto& path : paths) {
+///     pg::ScopedResource scratch(&arena);
+///     ...    // all arrays created here are recycled for the next image
+/// }
+/// @endcode
+class ScopedResource {
+private:
+    MemoryResource* previous_;
+
+public:
+    explicit ScopedResource(MemoryResource* resource);
+    ScopedResource(const ScopedResource&) = delete;
+    ScopedResource& operator=(const ScopedResource&) = delete;
+    ~ScopedResource();
+};
+
+}    // namespace pg
@@ -1,18 +1,27 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include "../src/pglib/ImgExpr.h"
+#include "PhotoGoodyzer/Allocator.h"
 #include "PhotoGoodyzer/ArrayBase.h"
+#include "PhotoGoodyzer/Math.h"
+#include "PhotoGoodyzer/Parallel.h"
+#include "PhotoGoodyzer/Reductions.h"
 
 namespace pg {
 
 /// Template class for 3-dimensional array representaion; base for the Image and Channel classes.
 ///
-/// The class may obtain already allocated array and use custom deleter function. The class
+/// The class allocates its data array from a MemoryResource (see Allocator.h), or may obtain
+/// already allocated array and use custom deleter function. The class
 /// implements basic element-wise arithmetic operators (+, -, *, /) and folowing funсtions with the
 /// use of expression templates: Abs(Array), Square(Array), Pow4(Array), Pow3(Array), Sqrt(Array),
 /// Cbrt(Array), Pow(Array, value). Expression templates also support operations on std::vector.
@@ -22,13 +31,32 @@ private:
     /// Data array
     std::unique_ptr<T[], std::function<void(T*)>> data_ = {nullptr, nullptr};
 
+    /// A deferred transformation of the data array (see Image::ChangeColorSpace())
+    struct Pending {
+        /// Transforms the data array of the given dimensions and layout in-place
+        std::function<void(const ArrayBase&, T*)> apply;
+        std::once_flag once;
+        std::atomic<bool> applied = false;
+    };
+
+    /// nullptr if there is nothing to apply
+    std::unique_ptr<Pending> pending_;
+
 public:
     Array() = default;
 
-    /// Constructs a blank array of given dimensions with the default deleter.
-    Array(int width, int height, int num_of_channels) :
-        ArrayBase(width, height, num_of_channels),
-        data_(new T[this->size()], [](T* ptr) { delete[] ptr; }) {}
+    /// Constructs a blank array of given dimensions. The data array is allocated from resource
+    /// and aligned to ARRAY_ALIGNMENT bytes.
+    Array(int width, int height, int num_of_channels,
+          MemoryResource* resource = GetDefaultResource()) :
+        Array(Layout::Interleaved, width, height, num_of_channels, resource) {}
+
+    /// Constructs a blank array of given dimensions and layout. The data array is allocated from
+    /// resource and aligned to ARRAY_ALIGNMENT bytes.
+    Array(Layout layout, int width, int height, int num_of_channels,
+          MemoryResource* resource = GetDefaultResource()) :
+        ArrayBase(width, height, num_of_channels, layout),
+        data_(AllocateData(this->size(), resource)) {}
 
     /// Constructs an Array object that uses an existing memory buffer, data.
     /// The buffer must be continuous, row-majored, without separations and strides, with channels
@@ -45,14 +73,17 @@ public:
           std::function<void(T*)> cleanup_function = nullptr) :
         ArrayBase(width, height, num_of_channels), data_(ptr, cleanup_function) {}
 
-    /// Constructs an Array copy with the default deleter.
+    /// Constructs an Array copy of the same layout allocated from the default resource.
     Array(const Array& other) :
-        Array(other.GetWidth(), other.GetHeight(), other.GetNumOfChannels()) {
+        Array(other.GetLayout(), other.GetWidth(), other.GetHeight(), other.GetNumOfChannels()) {
         std::copy(other.begin(), other.end(), this->begin());
     }
 
     /// Moves an Array.
-    Array(Array&& other) = default;
+    Array(Array&& other) noexcept :
+        ArrayBase(other),
+        data_(std::move(other.data_)),
+        pending_(std::move(other.pending_)) {}
 
     ~Array() = default;
 
@@ -61,34 +92,113 @@ public:
         return *this;
     }
 
-    Array& operator=(Array&& other) = default;
+    Array& operator=(Array&& other) noexcept {
+        ArrayBase::operator=(other);
+        data_ = std::move(other.data_);
+        pending_ = std::move(other.pending_);
+        return *this;
+    }
 
-    /// Convert an exression template to the Array.
+    /// Convert an exression template to the Array. The expression is evaluated in packs of
+    /// PackSize<T> elements, the remaining elements are evaluated one by one. Arrays with at least
+    /// ParallelSettings::serial_threshold elements are split into chunks of
+    /// ParallelSettings::chunk_bytes evaluated by several threads (see ParallelFor()).
     template <class Callable, class... Operands>
     void operator=(const ImgExpr<Callable, Operands...>& expr) {
         if (this->size() != expr.size())
             throw std::runtime_error("Sizes of an object and an expression must be equal");
-        for (size_t i = 0; i < this->size(); ++i) {
-            (*this)[i] = expr[i];
+        if (this->GetNumOfChannels() > 1 && expr.GetLayout() &&
+            *expr.GetLayout() != this->GetLayout())
+            throw std::runtime_error("Layouts of an object and an expression must be equal");
+        expr.Flush();
+        pending_.reset();    // the data is overwritten anyway
+        const ParallelSettings settings = GetParallelSettings();
+        if (this->size() < settings.serial_threshold) {
+            AssignRange(expr, 0, this->size());
+        } else {
+            constexpr size_t N = PackSize<T>;
+            size_t chunk_size = std::max(settings.chunk_bytes / sizeof(T) / N * N, N);
+            ParallelFor(this->size(), chunk_size,
+                        [this, &expr](size_t begin, size_t end) { AssignRange(expr, begin, end); });
         }
     }
 
     /// Gives an access to an element in the array, max index = ArrayBase::size() - 1
-    T& operator[](size_t i) { return data_[i]; }
+    T& operator[](size_t i) {
+        Flush();
+        return data_[i];
+    }
 
     /// Return a value an element in the array, max index = ArrayBase::size() - 1
-    T operator[](size_t i) const { return data_[i]; }
+    T operator[](size_t i) const {
+        Flush();
+        return data_[i];
+    }
+
+    /// Applies deferred transformations (see Image::ChangeColorSpace()) to the data array. Called
+    /// implicitly by begin(), end(), operator[] and before evaluation of expression templates and
+    /// reductions. Threads reading a const object may call it concurrently: the transformation
+    /// runs once, and the other threads wait for it.
+    void Flush() const {
+        if (pending_ && !pending_->applied.load(std::memory_order_acquire)) {
+            std::call_once(pending_->once, [this] {
+                pending_->apply(*this, data_.get());
+                pending_->applied.store(true, std::memory_order_release);
+            });
+        }
+    }
 
-    /// Checks whether two arrays have same dimensions and pixel data.
+    /// True if a deferred transformation is not applied to the data array yet
+    bool HasPending() const {
+        return pending_ && !pending_->applied.load(std::memory_order_acquire);
+    }
+
+    /// Checks whether two arrays have same dimensions, layout and pixel data.
     bool operator==(const Array<T>& rhs) {
-        if (!AreEqualDimensions(*this, rhs)) {
+        if (!AreEqualDimensions(*this, rhs) || this->GetLayout() != rhs.GetLayout()) {
             return false;
         } else {
             return IsEveryPixelEqual(rhs);
         }
     }
 
+private:
+    static std::unique_ptr<T[], std::function<void(T*)>> AllocateData(size_t size,
+                                                                     MemoryResource* resource) {
+        T* ptr = static_cast<T*>(resource->Allocate(size * sizeof(T), ARRAY_ALIGNMENT));
+        std::uninitialized_default_construct_n(ptr, size);
+        return {ptr, [resource, size](T* ptr) {
+                    std::destroy_n(ptr, size);
+                    resource->Deallocate(ptr, size * sizeof(T), ARRAY_ALIGNMENT);
+                }};
+    }
+
 protected:
+    /// Defers a transformation of the data array, replacing a pending one: apply(*this, data) is
+    /// called by the first Flush(). apply keeps the parameters of the transformation, so it stays
+    /// valid when the data array is moved to another object.
+    void SetPending(std::function<void(const ArrayBase&, T*)> apply) {
+        pending_ = std::make_unique<Pending>();
+        pending_->apply = std::move(apply);
+    }
+
+    /// Evaluates the [begin... end) range of an expression template into the array; begin must be
+    /// a multiple of PackSize<T>.
+    template <class Callable, class... Operands>
+    void AssignRange(const ImgExpr<Callable, Operands...>& expr, size_t begin, size_t end) {
+        constexpr size_t N = PackSize<T>;
+        size_t i = begin;
+        for (; i + N <= end; i += N) {
+            auto batch = expr.template Batch<N>(i);
+            for (size_t k = 0; k != N; ++k) {
+                data_[i + k] = batch[k];
+            }
+        }
+        for (; i < end; ++i) {
+            (*this)[i] = expr[i];
+        }
+    }
+
     bool IsEveryPixelEqual(const Array<T>& rhs) {
         auto rhs_ptr = rhs.begin();
         for (auto this_pix : *this) {
@@ -100,8 +210,11 @@ protected:
 
 public:
     bool empty() const { return !data_; }
-    T* begin() const { return data_.get(); }
-    T* end() const { return std::next(data_.get(), this->size()); }
+    T* begin() const {
+        Flush();
+        return data_.get();
+    }
+    T* end() const { return std::next(begin(), this->size()); }
     bool operator!() const { return !data_; }
     explicit operator bool() const { return bool(data_); }
 
@@ -141,10 +254,12 @@ public:
         }
     }
 
-    /// Provides std::pow() for all values of a data array in-place
+    /// Provides math::Pow() for all values of a data array in-place
     void Pow(T value) {
-        for (auto& pix : *this)
-            pix = std::pow(pix, value);
+        math::WithAccuracy([this, value](auto accuracy) {
+            for (auto& pix : *this)
+                pix = math::Pow(pix, value, accuracy);
+        });
     }
 
     /// Provides std::abs() for all values of a data array in-place
@@ -172,22 +287,4 @@ bool AreEqualDimensions(const Array<T1>& lhs, const Array<T2>& rhs) {
                             rhs.GetNumOfChannels(), rhs.size()));
 }
 
-/// Returns <min1, max1, min2, max2 ...> values of a data array
-template <typename T>
-std::vector<T> MinMaxValues(const Array<T>& img) {
-    std::vector<T> result(img.GetNumOfChannels() * 2);
-    auto iter = img.begin();
-    for (int i = 0; i != img.GetNumOfChannels(); ++i) {
-        result[2 * i] = *iter;
-        result[2 * i + 1] = *iter++;
-    }
-    for (int _ = 1; _ != img.GetImgSize(); ++_) {
-        for (int i = 0; i != img.GetNumOfChannels(); ++i) {
-            result[2 * i] = std::min(result[2 * i], *iter);
-            result[2 * i + 1] = std::max(result[2 * i + 1], *iter++);
-        }
-    }
-    return result;
-}
-
 }    // namespace pg
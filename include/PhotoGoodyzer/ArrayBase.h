@@ -2,6 +2,8 @@
 
 #include <cstddef>
 
+#include "PhotoGoodyzer/Layout.h"
+
 namespace pg {
 
 /// Base for the Array class characterizing dimensions of a data array.
@@ -17,10 +19,12 @@ private:
     /// array_size_ = width_* height_ * num_of_channels
     std::size_t array_size_ = 0;
 
+    Layout layout_ = Layout::Interleaved;
+
 protected:
     ArrayBase() = default;
 
-    ArrayBase(int width, int height, int num_of_channels);
+    ArrayBase(int width, int height, int num_of_channels, Layout layout = Layout::Interleaved);
 
 public:
     /// Returns size of the data array (width_* height_ * num_of_channels_)
@@ -42,6 +46,18 @@ public:
     /// Returns number of channels in the array (depth of the array)
     /// @return number of channels in the array (depth of the array)
     int GetNumOfChannels() const;
+
+    /// Returns the arrangement of channels in the data array
+    /// @return Layout of the array
+    Layout GetLayout() const;
+
+    /// Returns the distance between values of two neighbouring pixels of a channel
+    /// @return num_of_channels_ for Layout::Interleaved, 1 for Layout::Planar
+    std::size_t GetPixelStride() const;
+
+    /// Returns the index of the first value of a channel in the data array
+    /// @param channel_bias equals 0 for the first channel, equals 1 for the second channel, etc.
+    std::size_t GetChannelOffset(int channel_bias) const;
 };
 
 }    // namespace pg
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "../src/pglib/ImgExpr.h"
+#include "PhotoGoodyzer/Array.h"
+#include "PhotoGoodyzer/Parallel.h"
+
+namespace pg {
+
+/// Non-owning view of a rectangular 2-dimensional region of values placed with strides, e.g. a
+/// single channel of an interleaved Image or a region of a Channel.
+///
+/// Value (x, y) of the view is located at data[y * row_pitch + x * pixel_stride]. Views are cheap
+/// to copy; copying a view does not copy the values. A view takes part in expression templates as
+/// an operand of size width * height (elements are enumerated row by row), and an expression
+/// template can be assigned to a view, writing the values in place. Use ArrayView<const T> for
+/// read-only views. The viewed data must remain valid throughout the life of the view.
+template <typename T>
+class ArrayView : public ExprBase {
+private:
+    using Value = std::remove_const_t<T>;
+
+    T* data_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    size_t row_pitch_ = 0;
+    size_t pixel_stride_ = 1;
+
+public:
+    ArrayView() = default;
+
+    /// Constructs a view of existing data.
+    /// @param data Pointer to the value (0, 0)
+    /// @param width Width of the view in values
+    /// @param height Height of the view in values
+    /// @param row_pitch Distance between the beginnings of two consecutive rows, in elements of T
+    /// @param pixel_stride Distance between two consecutive values in a row, in elements of T
+    ArrayView(T* data, int width, int height, size_t row_pitch, size_t pixel_stride = 1) :
+        data_(data),
+        width_(width),
+        height_(height),
+        row_pitch_(row_pitch),
+        pixel_stride_(pixel_stride) {}
+
+    /// Constructs a view of a whole single-channel Array (e.g. a Channel).
+    template <typename U, class = std::enable_if_t<std::is_same_v<std::remove_const_t<T>, U>>>
+    ArrayView(const Array<U>& array) :
+        ArrayView(array.begin(), array.GetWidth(), array.GetHeight(), array.GetWidth()) {
+        if (array.GetNumOfChannels() != 1)
+            throw std::runtime_error("Only single-channel arrays can be viewed as a whole");
+    }
+
+    /// Converts a view to a read-only view.
+    template <class U = T, class = std::enable_if_t<!std::is_const_v<U>>>
+    operator ArrayView<const Value>() const {
+        return {data_, width_, height_, row_pitch_, pixel_stride_};
+    }
+
+    size_t size() const { return size_t(width_) * height_; }
+    int GetWidth() const { return width_; }
+    int GetHeight() const { return height_; }
+    size_t GetRowPitch() const { return row_pitch_; }
+    size_t GetPixelStride() const { return pixel_stride_; }
+    T* data() const { return data_; }
+
+    /// True if the last value of every row is followed by the first value of the next row with
+    /// the same stride, so the i-th value is data[i * pixel_stride].
+    bool IsDense() const { return row_pitch_ == size_t(width_) * pixel_stride_ || height_ <= 1; }
+
+    /// Gives an access to the value (x, y).
+    T& At(int x, int y) const { return data_[y * row_pitch_ + x * pixel_stride_]; }
+
+    /// Gives an access to the i-th value of the view counting row by row, max index = size() - 1.
+    T& operator[](size_t i) const {
+        if (IsDense()) {
+            return data_[i * pixel_stride_];
+        } else {
+            return data_[(i / width_) * row_pitch_ + (i % width_) * pixel_stride_];
+        }
+    }
+
+    /// Returns N consecutive values starting from the i-th one (see ImgExpr::Batch()).
+    template <std::size_t N>
+    Pack<Value, N> Batch(size_t i) const {
+        Pack<Value, N> result;
+        ForBatch<N>(i, [&result](size_t k, T& value) { result[k] = value; });
+        return result;
+    }
+
+    /// Returns a view of the region of the view, with (x, y) as the upper left corner.
+    ArrayView Region(int x, int y, int width, int height) const {
+        if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > width_ ||
+            y + height > height_)
+            throw std::runtime_error("The region must be inside the view");
+        return {&At(x, y), width, height, row_pitch_, pixel_stride_};
+    }
+
+    /// Writes values of an expression template to the viewed data; see Array::operator=() for
+    /// the evaluation details.
+    template <class Callable, class... Operands>
+    const ArrayView& operator=(const ImgExpr<Callable, Operands...>& expr) const {
+        static_assert(!std::is_const_v<T>, "Cannot assign to a read-only view");
+        if (this->size() != expr.size())
+            throw std::runtime_error("Sizes of a view and an expression must be equal");
+        expr.Flush();
+        constexpr size_t N = PackSize<Value>;
+        auto assign_range = [this, &expr](size_t begin, size_t end) {
+            size_t i = begin;
+            for (; i + N <= end; i += N) {
+                auto batch = expr.template Batch<N>(i);
+                ForBatch<N>(i, [&batch](size_t k, T& value) { value = batch[k]; });
+            }
+            for (; i < end; ++i) {
+                (*this)[i] = expr[i];
+            }
+        };
+        const ParallelSettings settings = GetParallelSettings();
+        if (this->size() < settings.serial_threshold) {
+            assign_range(0, this->size());
+        } else {
+            size_t chunk_size = std::max(settings.chunk_bytes / sizeof(Value) / N * N, N);
+            ParallelFor(this->size(), chunk_size, assign_range);
+        }
+        return *this;
+    }
+
+    /// Calls func(value) for every value of the view row by row.
+    template <class Func>
+    void ForEach(Func func) const {
+        for (int y = 0; y != height_; ++y) {
+            T* ptr = data_ + y * row_pitch_;
+            for (int x = 0; x != width_; ++x) {
+                func(ptr[x * pixel_stride_]);
+            }
+        }
+    }
+
+    /// Fills the viewed values with value.
+    void Fill(Value value) const {
+        ForEach([value](T& pix) { pix = value; });
+    }
+
+private:
+    /// Calls func(k, value) for N consecutive values starting from the i-th one
+    template <std::size_t N, class Func>
+    void ForBatch(size_t i, Func func) const {
+        if (IsDense()) {
+            T* ptr = data_ + i * pixel_stride_;
+            for (size_t k = 0; k != N; ++k) {
+                func(k, ptr[k * pixel_stride_]);
+            }
+        } else {
+            size_t col = i % width_;
+            T* row_ptr = data_ + (i / width_) * row_pitch_;
+            for (size_t k = 0; k != N; ++k) {
+                func(k, row_ptr[col * pixel_stride_]);
+                if (++col == size_t(width_)) {
+                    col = 0;
+                    row_ptr += row_pitch_;
+                }
+            }
+        }
+    }
+};
+
+/// Returns a view of a single channel of an Array without copying.
+/// @param src Source Array
+/// @param channel_bias The channel bias in the Array. channel_bias equals 0 for the first
+/// channel, equals 1 for the second channel, etc.
+template <typename T>
+ArrayView<T> ChannelView(Array<T>& src, int channel_bias) {
+    if (channel_bias < 0 || channel_bias >= src.GetNumOfChannels())
+        throw std::runtime_error(
+            "Channel bias cannot be greater or equal to the number of channels");
+    size_t pixel_stride = src.GetPixelStride();
+    return {src.begin() + src.GetChannelOffset(channel_bias), src.GetWidth(), src.GetHeight(),
+            src.GetWidth() * pixel_stride, pixel_stride};
+}
+
+/// Returns a read-only view of a single channel of an Array without copying.
+/// @see ChannelView(Array<T>&, int)
+template <typename T>
+ArrayView<const T> ChannelView(const Array<T>& src, int channel_bias) {
+    return ChannelView(const_cast<Array<T>&>(src), channel_bias);
+}
+
+/// Returns <min1, max1, min2, max2 ...> values of a data array
+template <typename T>
+std::vector<T> MinMaxValues(const Array<T>& img) {
+    if (img.GetLayout() == Layout::Interleaved) {
+        return MinMax(img, img.GetNumOfChannels());
+    }
+    std::vector<T> result;
+    for (int channel = 0; channel != img.GetNumOfChannels(); ++channel) {
+        auto min_max = MinMax(ChannelView(img, channel));
+        result.insert(result.end(), min_max.begin(), min_max.end());
+    }
+    return result;
+}
+
+/// Rescales the viewed values in a way that values in the [in_min... in_max] range became values
+/// in the [out_min... out_max] range; values outside the [in_min... in_max] range are cliped to
+/// out_min, out_max
+template <typename T>
+void Rescale(const ArrayView<T>& view, T in_min, T in_max, T out_min = 0.0f, T out_max = 1.0f) {
+    view.ForEach([=](T& pix) {
+        if (pix <= in_min) {
+            pix = out_min;
+        } else if (pix >= in_max) {
+            pix = out_max;
+        } else {
+            pix = (pix - in_min) / (in_max - in_min) * (out_max - out_min) + out_min;
+        }
+    });
+}
+
+}    // namespace pg
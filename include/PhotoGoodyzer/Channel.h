@@ -2,10 +2,12 @@
 
 #include <memory>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 #include "../src/pglib/Equalizer.h"
 #include "PhotoGoodyzer/Array.h"
+#include "PhotoGoodyzer/ArrayView.h"
 
 /// Functions and classes in this namespace provide basic image manipulations
 /// such as element-wise arithmetic operations, converting to different colorspaces, channel
@@ -14,6 +16,21 @@
 /// Classes use expression templates.
 namespace pg {
 
+/// Returns [lower, upper] values of the view corresponding to lower_b, upper_b percentile in
+/// decimal form. @see Channel::Percentile()
+template <typename T, typename Value = std::remove_const_t<T>>
+std::pair<Value, Value> Percentile(const ArrayView<T>& view, float lower_b = 0.0f,
+                                   float upper_b = 1.0f) {
+    Equalizer<Value> eq(view);
+    return {eq.FindLowerPercentile(lower_b), eq.FindUpperPercentile(upper_b)};
+}
+
+/// Performs histogram equalization of the viewed values in place. @see Channel::Equalize()
+template <typename T>
+void Equalize(const ArrayView<T>& view, T out_min = 0, T out_max = 1) {
+    Equalizer<T>(view).ExportEqualized(view, out_min, out_max);
+}
+
 /// Template class for a single channel of an image, providing manipulations such as rescaling,
 /// equalization, cropping, etc.
 ///
@@ -24,15 +41,12 @@ namespace pg {
 /// on std::vector.
 template <typename T>
 class Channel : public Array<T> {
-private:
-    /// Equalizer class object needed to perform histogram equalization of the channel
-    mutable std::shared_ptr<Equalizer<T>> eq_ = nullptr;
-
 public:
     Channel() = default;
 
-    /// Constructs a blank channel of given dimensions with the default array deleter.
-    explicit Channel(int width, int height) : Array<T>(width, height, 1) {}
+    /// Constructs a blank channel of given dimensions allocated from resource.
+    explicit Channel(int width, int height, MemoryResource* resource = GetDefaultResource()) :
+        Array<T>(width, height, 1, resource) {}
 
     /// Constructs an Channel object that uses an existing memory buffer, data.
     /// The buffer must be continuous, row-majored, without separations and strides.
@@ -46,7 +60,7 @@ public:
     Channel(T* ptr, int width, int height, std::function<void(T*)> cleanup_function = nullptr) :
         Array<T>(ptr, width, height, 1, cleanup_function) {}
 
-    /// Constructs a channel copy with the default deleter.
+    /// Constructs a channel copy allocated from the default resource.
     Channel(const Channel& other) : Channel(other.GetWidth(), other.GetHeight()) {
         std::copy(other.begin(), other.end(), this->begin());
     }
@@ -86,35 +100,21 @@ public:
     /// in the [out_min... out_max] range; values outside the [in_min... in_max] range are cliped to
     /// out_min, out_max
     void Rescale(T in_min, T in_max, T out_min = 0.0f, T out_max = 1.0f) {
-        for (auto& pix : *this) {
-            if (pix <= in_min) {
-                pix = out_min;
-            } else if (pix >= in_max) {
-                pix = out_max;
-            } else {
-                pix = (pix - in_min) / (in_max - in_min) * (out_max - out_min) + out_min;
-            }
-        }
+        pg::Rescale(ArrayView<T>(*this), in_min, in_max, out_min, out_max);
     }
 
     /// Return [lower, upper] values of the channel corresponding to lower_b, upper_b percentile in
     /// decimal form. For example, Percentile(0.25, 0.75) will return values corresponding to 25%
     /// and 75% of the array from lowest to highest values.
     std::pair<T, T> Percentile(float lower_b = 0.0f, float upper_b = 1.0f) const {
-        if (!eq_)
-            eq_ = std::make_shared<Equalizer<T>>(*this);
-        T lower = eq_->FindLowerPercentile(lower_b);
-        T upper = eq_->FindUpperPercentile(upper_b);
-        return {lower, upper};
+        return pg::Percentile(ArrayView<const T>(*this), lower_b, upper_b);
     }
 
     /// Perform histogram equalization of the channel; values of the channel tend to be distributed
     /// evenly between out_min and out_max. Values outside the [out_min... out_max] range are cliped
     /// to out_min, out_max.
     void Equalize(T out_min = 0, T out_max = 1) {
-        if (!eq_)
-            eq_ = std::make_shared<Equalizer<T>>(*this);
-        eq_->ExportEqualized(*this, out_min, out_max);
+        pg::Equalize(ArrayView<T>(*this), out_min, out_max);
     }
 };
 
@@ -133,21 +133,39 @@ Channel<T> Crop(const Channel<T>& other, int width_field, int heigth_field) {
     return dst;
 }
 
+/// Crops the channel to the width x height region with the top left corner (x, y).
+template <typename T>
+Channel<T> Crop(const Channel<T>& other, int x, int y, int width, int height) {
+    if (x < 0 || y < 0 || x + width > other.GetWidth() || y + height > other.GetHeight())
+        throw std::runtime_error("The region must be inside the channel");
+    Channel<T> dst(width, height);
+    auto line_begin = std::next(other.begin(), other.GetWidth() * y + x);
+    for (auto iter = dst.begin(); iter != dst.end(); std::advance(iter, width)) {
+        std::copy(line_begin, std::next(line_begin, width), iter);
+        std::advance(line_begin, other.GetWidth());
+    }
+    return dst;
+}
+
 /// Constructs a specified Channel object copying data from an Array.
 /// @param src Source Array
 /// @param channel_bias The channel bias in the Array. channel_bias
 /// equals 0 for the first channel, equals 1 for the second channel, etc.
 /// @returns New constructed channel.
 template <typename T>
-Channel<T> CopyChannel(const Array<T> src, int channel_bias) {
+Channel<T> CopyChannel(const Array<T>& src, int channel_bias) {
     if (channel_bias >= src.GetNumOfChannels())
         throw std::runtime_error(
             "Channel bias cannot be greater or equal to the number of channels");
     Channel<T> dst(src.GetWidth(), src.GetHeight());
-    auto src_ptr = std::next(src.begin(), channel_bias);
+    auto src_ptr = std::next(src.begin(), src.GetChannelOffset(channel_bias));
+    if (src.GetPixelStride() == 1) {
+        std::copy(src_ptr, std::next(src_ptr, dst.size()), dst.begin());
+        return dst;
+    }
     for (auto& pix : dst) {
         pix = *src_ptr;
-        std::advance(src_ptr, src.GetNumOfChannels());
+        std::advance(src_ptr, src.GetPixelStride());
     }
     return dst;
 }
@@ -164,10 +182,14 @@ void LoadFromChannel(Array<T>& dst, const Channel<T>& src, int channel_bias) {
             "Channel bias cannot be greater or equal to the number of channels");
     if (dst.GetImgSize() != src.GetImgSize())
         throw std::runtime_error("Sizes must be equal");
-    auto dst_ptr = std::next(dst.begin(), channel_bias);
+    auto dst_ptr = std::next(dst.begin(), dst.GetChannelOffset(channel_bias));
+    if (dst.GetPixelStride() == 1) {
+        std::copy(src.begin(), src.end(), dst_ptr);
+        return;
+    }
     for (auto pix : src) {
         *dst_ptr = pix;
-        std::advance(dst_ptr, dst.GetNumOfChannels());
+        std::advance(dst_ptr, dst.GetPixelStride());
     }
 }
 
@@ -187,6 +209,13 @@ void LoadFromChannels(Array<T>& dst, const std::vector<Channel<T>>& channels) {
         }
         iters.push_back(channel.begin());
     }
+    if (dst.GetLayout() == Layout::Planar) {
+        for (int i = 0; i != int(channels.size()); ++i) {
+            std::copy(channels[i].begin(), channels[i].end(),
+                      std::next(dst.begin(), dst.GetChannelOffset(i)));
+        }
+        return;
+    }
     auto dst_iter = dst.begin();
     for (int _ = 0; _ != dst.GetImgSize(); ++_) {
         for (int i = 0; i != int(iters.size()); ++i) {
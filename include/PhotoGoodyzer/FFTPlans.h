@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace pg {
+
+/// Rigor of planning of the Fourier transforms used by Gaussian blur (see FFTW planner flags).
+enum struct PlanRigor {
+    Estimate,    ///< FFTW_ESTIMATE: instant planning, slower transforms
+    Measure,     ///< FFTW_MEASURE: planning takes up to seconds per size, faster transforms
+    Patient,     ///< FFTW_PATIENT: planning may take minutes per size, fastest transforms
+};
+
+/// Sets the rigor of plans created afterwards. Plans are cached process-wide by size, direction,
+/// alignment of data, rigor and number of threads, so a batch of images of the same few
+/// resolutions plans only once per resolution; measured plans pay off in such batches, especially
+/// together with wisdom.
+void SetPlanRigor(PlanRigor rigor);
+
+/// Returns the rigor of newly created plans; PlanRigor::Estimate by default.
+PlanRigor GetPlanRigor();
+
+/// Enables or disables multi-threaded Fourier transforms (enabled by default). Plans created
+/// afterwards use GetNumThreads() threads, and their parallel loops run on GetDefaultExecutor()
+/// like the other operations; transforms called from parallel tasks run serially. Multi-threading
+/// needs the fftw3f_threads library of FFTW 3.3.9 or newer (the FFTW_THREADS_ENABLED CMake
+/// option); without it transforms always run on the calling thread.
+void SetMultiThreadedFFT(bool enabled);
+
+/// Returns true if newly created plans are multi-threaded.
+bool IsMultiThreadedFFT();
+
+/// Returns the number of cached plans.
+std::size_t GetNumOfCachedPlans();
+
+/// Destroys all cached plans; no Fourier transform may run during the call.
+void ClearPlanCache();
+
+/// Imports FFTW wisdom (results of previous planning) from a file; returns false if the file
+/// cannot be read.
+bool ImportWisdom(const std::string& filename);
+
+/// Exports FFTW wisdom accumulated by the process to a file; returns false on failure.
+bool ExportWisdom(const std::string& filename);
+
+/// Imports FFTW wisdom from a file at construction and exports it back at destruction, so
+/// measured plans survive between runs of an application.
+///
+/// Example:
+/// @code
+/// pg::WisdomFile wisdom("photogoodyzer.wisdom");
+/// pg::SetPlanRigor(pg::PlanRigor::Measure);
+/// ...    // process images
+/// @endcode
+class WisdomFile {
+private:
+    std::string filename_;
+
+public:
+    explicit WisdomFile(std::string filename);
+    WisdomFile(const WisdomFile&) = delete;
+    WisdomFile& operator=(const WisdomFile&) = delete;
+    ~WisdomFile();
+};
+
+}    // namespace pg
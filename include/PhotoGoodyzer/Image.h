@@ -1,12 +1,15 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <stdexcept>
 
+#include "../src/pglib/Interleave.h"
 #include "../src/pglib/TransferMatrix.h"
 #include "../src/pglib/XYZvLab.h"
 #include "PhotoGoodyzer/Array.h"
 #include "PhotoGoodyzer/ColorSpace.h"
+#include "PhotoGoodyzer/Layout.h"
 
 namespace pg {
 
@@ -16,17 +19,35 @@ namespace pg {
 /// implements basic element-wise arithmetic operators (+, -, *, /) and folowing funсtions with the
 /// use of expression templates: Abs(Image), Square(Image), Pow4(Image), Pow3(Image), Sqrt(Image),
 /// Cbrt(Image), Pow(Image, value). Expression templates also support operations on std::vector.
+///
+/// Channels are interleaved by default; a Layout::Planar image keeps every channel contiguous, so
+/// color space transformations and per-pixel operations work on unit-stride data. Operations
+/// return images of the layout of their source, so a pipeline stays planar once the image is
+/// converted (see LinRGBFromSRGB(), ChangeLayout()).
 template <typename T>
 class Image : public Array<T> {
 private:
     ColorSpace color_space_ = ColorSpace::RGB;
 
+    /// Product of the deferred color space transformation matrices, which later ones are folded
+    /// into; valid while Array::HasPending()
+    TransferMatrix pending_matrix_;
+
+    /// True if values are clipped to [0... 1] after pending_matrix_ is applied
+    bool pending_clip_ = false;
+
 public:
     Image() = default;
 
-    /// Constructs a blank image of given dimensions with the default array deleter.
-    explicit Image(ColorSpace color_space, int width, int height, int num_of_channels) :
-        Array<T>(width, height, num_of_channels), color_space_(color_space) {}
+    /// Constructs a blank image of given dimensions allocated from resource.
+    explicit Image(ColorSpace color_space, int width, int height, int num_of_channels,
+                   MemoryResource* resource = GetDefaultResource()) :
+        Array<T>(width, height, num_of_channels, resource), color_space_(color_space) {}
+
+    /// Constructs a blank image of given dimensions and layout allocated from resource.
+    explicit Image(ColorSpace color_space, Layout layout, int width, int height,
+                   int num_of_channels, MemoryResource* resource = GetDefaultResource()) :
+        Array<T>(layout, width, height, num_of_channels, resource), color_space_(color_space) {}
 
     /// Constructs an Image object that uses an existing memory buffer, data.
     /// The buffer must be continuous, row-majored, without separations and strides, with channels
@@ -46,11 +67,10 @@ public:
         color_space_(color_space) {}
 
     /// Constructs an image from other image with transformation to desired ColorSpace;
-    /// uses the default deleter.
+    /// allocated from the default resource, keeps the layout of other.
     Image(const Image& other, ColorSpace desired_clrs) :
-        Image(desired_clrs, other.GetWidth(), other.GetHeight(), other.GetNumOfChannels()) {
-        auto this_ptr = this->begin();
-        auto other_ptr = other.begin();
+        Image(desired_clrs, other.GetLayout(), other.GetWidth(), other.GetHeight(),
+              other.GetNumOfChannels()) {
         if (other.GetColorSpace() == desired_clrs) {
             std::copy(other.begin(), other.end(), this->begin());
         } else {
@@ -58,16 +78,7 @@ public:
             if (map_iter == DST_FROM_SRC.end()) {
                 this->CheckNonLinearTransform(other, desired_clrs);
             } else {
-                TransferMatrix tm = map_iter->second;
-                T r, g, b;
-                for (int _ = 0; _ != this->GetImgSize(); ++_) {
-                    r = *other_ptr++;
-                    g = *other_ptr++;
-                    b = *other_ptr++;
-                    *this_ptr++ = tm.row1[0] * r + tm.row1[1] * g + tm.row1[2] * b;
-                    *this_ptr++ = tm.row2[0] * r + tm.row2[1] * g + tm.row2[2] * b;
-                    *this_ptr++ = tm.row3[0] * r + tm.row3[1] * g + tm.row3[2] * b;
-                }
+                ApplyMatrix(other, map_iter->second);
             }
         }
         if (this->GetColorSpace() == ColorSpace::RGB) {
@@ -75,9 +86,9 @@ public:
         }
     }
 
-    /// Constructs an image copy with the default deleter.
+    /// Constructs an image copy allocated from the default resource.
     Image(const Image& other) :
-        Image(other.GetColorSpace(), other.GetWidth(), other.GetHeight(),
+        Image(other.GetColorSpace(), other.GetLayout(), other.GetWidth(), other.GetHeight(),
               other.GetNumOfChannels()) {
         std::copy(other.begin(), other.end(), this->begin());
     }
@@ -90,28 +101,45 @@ public:
     const ColorSpace& GetColorSpace() const { return color_space_; }
 
     /// Convert the image to the desired ColorSpace in-place.
+    ///
+    /// Linear (matrix) transformations are deferred: consecutive ones are multiplied into a
+    /// single matrix which is applied in one pass, together with clipping of RGB values, when
+    /// the values are accessed or a nonlinear transformation runs (see Array::Flush()).
     void ChangeColorSpace(ColorSpace desired_clrs) {
         auto map_iter = DST_FROM_SRC.find({desired_clrs, this->GetColorSpace()});
         if (map_iter == DST_FROM_SRC.end()) {
             this->CheckNonLinearTransform(*this, desired_clrs);
+            if (this->GetColorSpace() == ColorSpace::RGB) {
+                this->Clip(0.0f, 1.0f);
+            }
         } else {
-            TransferMatrix tm = map_iter->second;
-            auto pixel_ptr = this->begin();
-            auto color_ptr = this->begin();
-            T r, g, b;
-            for (int _ = 0; _ != this->GetImgSize(); ++_) {
-                r = *color_ptr++;
-                g = *color_ptr++;
-                b = *color_ptr++;
-                *pixel_ptr++ = tm.row1[0] * r + tm.row1[1] * g + tm.row1[2] * b;
-                *pixel_ptr++ = tm.row2[0] * r + tm.row2[1] * g + tm.row2[2] * b;
-                *pixel_ptr++ = tm.row3[0] * r + tm.row3[1] * g + tm.row3[2] * b;
+            if (this->HasPending() && pending_clip_) {
+                this->Flush();    // clipping is not linear
             }
+            pending_matrix_ =
+                this->HasPending() ? map_iter->second * pending_matrix_ : map_iter->second;
+            pending_clip_ = desired_clrs == ColorSpace::RGB;
+            const TransferMatrix tm = pending_matrix_;
+            const bool clip = pending_clip_;
+            this->SetPending([tm, clip](const ArrayBase& layout, T* data) {
+                MapPixels(layout, data, layout, data, [&tm, clip](T c0, T c1, T c2) {
+                    return TransformPixel(tm, clip, c0, c1, c2);
+                });
+            });
             color_space_ = desired_clrs;
         }
-        if (this->GetColorSpace() == ColorSpace::RGB) {
-            this->Clip(0.0f, 1.0f);
+    }
+
+    /// Rearranges channels of the image to the desired Layout; the new data array is allocated
+    /// from the default resource.
+    void ChangeLayout(Layout desired_layout) {
+        if (this->GetLayout() == desired_layout) {
+            return;
         }
+        Image result(color_space_, desired_layout, this->GetWidth(), this->GetHeight(),
+                     this->GetNumOfChannels());
+        ConvertArray(*this, result, [](T value) { return value; });
+        *this = std::move(result);
     }
 
     Image& operator=(const Image& other) {
@@ -140,44 +168,68 @@ private:
     }
 
     void LabFromXYZ(const Image& img_XYZ) {
-        auto XYZ_ptr = img_XYZ.begin();
-        auto Lab_ptr = this->begin();
-        for (int _ = 0; _ != img_XYZ.GetImgSize(); ++_) {
-            T x = Labf_function(*XYZ_ptr++ / 0.950489f);    // for Standart Illuminnat D65
-            T y = Labf_function(*XYZ_ptr++);
-            T z = Labf_function(*XYZ_ptr++ / 1.088840f);
-            *Lab_ptr++ = 116.0f * y - 16.0f;    // L
-            *Lab_ptr++ = 500.0f * (x - y);      // a
-            *Lab_ptr++ = 200.0f * (y - z);      // b
-        }
+        math::WithAccuracy([&](auto accuracy) {
+            MapPixels(img_XYZ, *this,
+                      [accuracy](T X, T Y, T Z) { return LabFromXYZPixel(X, Y, Z, accuracy); });
+        });
         color_space_ = ColorSpace::Lab;
     }
 
     void XYZFromLab(const Image& img_Lab) {
-        auto Lab_ptr = img_Lab.begin();
-        auto XYZ_ptr = this->begin();
-        for (int _ = 0; _ != img_Lab.GetImgSize(); ++_) {
-            T var_Y = (*Lab_ptr++ + 16.0f) / 116.0f;
-            T var_X = *Lab_ptr++ / 500.0f + var_Y;
-            T var_Z = var_Y - *Lab_ptr++ / 200.0f;
-            *XYZ_ptr++ = LabReversedf_function(var_X) * 0.950489f;    // X
-            *XYZ_ptr++ = LabReversedf_function(var_Y);                // Y
-            *XYZ_ptr++ = LabReversedf_function(var_Z) * 1.088840f;    // Z
-        }
+        MapPixels(img_Lab, *this, [](T L, T a, T b) { return XYZFromLabPixel(L, a, b); });
         color_space_ = ColorSpace::XYZ;
     }
+
+    /// Returns the pixel transformed by tm, clipped to [0... 1] if clip is true
+    static std::array<T, 3> TransformPixel(const TransferMatrix& tm, bool clip, T c0, T c1, T c2) {
+        auto pix = ApplyTransferMatrix(tm, c0, c1, c2);
+        if (clip) {
+            for (auto& value : pix) {
+                value = value < T(0) ? T(0) : (value > T(1) ? T(1) : value);
+            }
+        }
+        return pix;
+    }
+
+    /// Writes src transformed by tm to the image, clipping the results to [0... 1] if clip is
+    /// true.
+    void ApplyMatrix(const Image& src, const TransferMatrix& tm, bool clip = false) {
+        if (src.GetLayout() != this->GetLayout())
+            throw std::runtime_error("Layouts of images must be equal");
+        MapPixels(src, *this,
+                  [&tm, clip](T c0, T c1, T c2) { return TransformPixel(tm, clip, c0, c1, c2); });
+    }
 };
 
-/// Convert unsigned char sRGB image to float Linear RGB image.
-Image<float> LinRGBFromSRGB(const Image<unsigned char>& src_sRGB);
+/// Convert unsigned char sRGB image to float Linear RGB image of the desired layout;
+/// deinterleaving is fused with the conversion.
+Image<float> LinRGBFromSRGB(const Image<unsigned char>& src_sRGB,
+                            Layout layout = Layout::Interleaved);
 
-/// Convert float Linear RGB image to unsigned char sRGB image.
+/// Convert float Linear RGB image of any layout to interleaved unsigned char sRGB image.
 Image<unsigned char> SRGBFromLinRGB(const Image<float>& src_rgb);
 
-/// Convert unsigned char sRGB image to existing float Linear RGB image
+/// Convert unsigned char sRGB image to existing float Linear RGB image; layouts may differ.
 void LinRGBFromSRGB(Image<float>& dst_linRGB, const Image<unsigned char>& src_sRGB);
 
-/// Convert float Linear RGB image to existing unsigned char sRGB image.
+/// Convert float Linear RGB image to existing unsigned char sRGB image; layouts may differ.
 void SRGBFromLinRGB(Image<unsigned char>& dst_sRGB, const Image<float>& src_linRGB);
 
+/// Convert unsigned char sRGB image to float image of the desired ColorSpace and layout in a
+/// single pass: decoding, the color space transformation and deinterleaving are fused.
+/// desired_clrs may be ColorSpace::RGB, ColorSpace::Lab or a color space with a direct transfer
+/// matrix from linear RGB (e.g. ColorSpace::XYZ). Only 3-channel images are supported.
+Image<float> ImageFromSRGB(const Image<unsigned char>& src_sRGB, ColorSpace desired_clrs,
+                           Layout layout = Layout::Interleaved);
+
+/// Convert float image of ColorSpace::RGB, ColorSpace::Lab or a color space with a direct transfer
+/// matrix to linear RGB (e.g. ColorSpace::XYZ) to interleaved unsigned char sRGB image in a single
+/// pass: the color space transformation, clipping, encoding and interleaving are fused. Only
+/// 3-channel images are supported.
+Image<unsigned char> SRGBFromImage(const Image<float>& src);
+
+/// Convert float image to existing unsigned char sRGB image in a single pass.
+/// @see SRGBFromImage(const Image<float>&)
+void SRGBFromImage(Image<unsigned char>& dst_sRGB, const Image<float>& src);
+
 }    // namespace pg
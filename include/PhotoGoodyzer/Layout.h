@@ -0,0 +1,20 @@
+#pragma once
+
+namespace pg {
+
+/// Possible arrangement of the channels of a data array in memory.
+///
+/// Element-wise operations and expression templates do not depend on the layout, but all
+/// multi-channel arrays taking part in an expression must have the same layout; otherwise
+/// std::runtime_error is thrown.
+enum struct Layout {
+    /// Values of a pixel follow each other (e.g. R, G, B, R, G, B...); used by image files and
+    /// the default one.
+    Interleaved,
+
+    /// Every channel is stored contiguously, channels follow each other (e.g. R, R... G, G... B,
+    /// B...); per-pixel color math on planar images works on unit-stride data.
+    Planar
+};
+
+}    // namespace pg
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// Elementary functions used by per-pixel operations and expression templates with a library-wide
+/// speed/accuracy setting. The approximations are branch-free polynomials, so loops calling them
+/// are vectorized by compilers; call them in loops with a constant accuracy, e.g. inside
+/// WithAccuracy(). Values of other types than float are computed by <cmath> at every accuracy.
+namespace pg::math {
+
+/// Accuracy tiers of the functions of pg::math
+enum struct Accuracy {
+    Exact,    ///< Functions of <cmath>
+    High,     ///< Relative error below 1e-6: polynomials partly evaluated in double precision
+    Fast,     ///< Relative error below 1e-4: polynomials evaluated in single precision
+};
+
+/// Sets the accuracy of the functions called without an explicit one, i.e. of Pow() and Cbrt()
+/// expressions, Lab conversions, Gaussian kernels, local lightness and IPT adaptations.
+/// Accuracy::Exact initially. Change it between operations, not while they run.
+void SetAccuracy(Accuracy accuracy);
+
+namespace detail {
+
+extern std::atomic<Accuracy> accuracy;
+
+/// Returns 2^n as a float for n in [-126... 127]
+inline float Exp2Int(std::int32_t n) {
+    std::int32_t bits = (n + 127) << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/// Sum of t2^i / (2 * i + 1) for i in [k... terms) by Horner's scheme unrolled at compile time,
+/// so loops over values calling it have no inner loops and are vectorized
+template <int k, int terms>
+inline double AtanhSeries(double t2) {
+    if constexpr (k == terms - 1) {
+        return 1.0 / (2 * k + 1);
+    } else {
+        return AtanhSeries<k + 1, terms>(t2) * t2 + 1.0 / (2 * k + 1);
+    }
+}
+
+/// Sum of r^i * k! / i! for i in [k... degree] by Horner's scheme unrolled at compile time
+template <int k, int degree, typename T>
+inline T ExpSeries(T r) {
+    if constexpr (k == degree) {
+        return T(1);
+    } else {
+        return ExpSeries<k + 1, degree>(r) * r / T(k + 1) + T(1);
+    }
+}
+
+/// Natural logarithm of x > 0: x = 2^e * m with m in [sqrt(0.5)... sqrt(2)) and
+/// log(m) = 2 * atanh(t) for t = (m - 1) / (m + 1), |t| < 0.172, summed up to t^(2 * terms - 1)
+template <int terms>
+inline double LogPoly(float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    // Exponent relative to sqrt(0.5), so m is in [sqrt(0.5)... sqrt(2))
+    const std::uint32_t shifted = bits - 0x3F3504F3u;
+    const double e = double(std::int32_t(shifted) >> 23);
+    const std::uint32_t m_bits = (shifted & 0x007FFFFFu) + 0x3F3504F3u;
+    float m;
+    std::memcpy(&m, &m_bits, sizeof(m));
+    const double t = (double(m) - 1.0) / (double(m) + 1.0);
+    return e * 0.69314718055994530942 + 2.0 * t * AtanhSeries<0, terms>(t * t);
+}
+
+/// e^x by 2^n * e^r for r = x - n * log(2) in [-0.35... 0.35], summed up to r^degree in the
+/// precision of T; x must be in [-87.3... 88], so 2^n is a normal float
+template <int degree, typename T>
+inline float ExpPoly(T x) {
+    // Rounding to the nearest by truncation of a positive value; no rounding instructions needed
+    const std::int32_t n = std::int32_t(x * T(1.44269504088896340736) + T(200.5)) - 200;
+    // log(2) split into a part exact in float and a small remainder
+    const T r = (x - T(n) * T(0.693145751953125)) - T(n) * T(1.428606820309417232e-06);
+    return float(ExpSeries<0, degree>(r)) * Exp2Int(n);
+}
+
+/// Fast natural logarithm of x > 0 in single precision, summed up to t^5
+inline float LogFast(float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const std::uint32_t shifted = bits - 0x3F3504F3u;
+    const float e = float(std::int32_t(shifted) >> 23);
+    const std::uint32_t m_bits = (shifted & 0x007FFFFFu) + 0x3F3504F3u;
+    float m;
+    std::memcpy(&m, &m_bits, sizeof(m));
+    const float t = (m - 1.0f) / (m + 1.0f);
+    const float t2 = t * t;
+    return e * 0.693147180f + 2.0f * t * (1.0f + t2 * (1.0f / 3.0f + t2 * 0.2f));
+}
+
+}    // namespace detail
+
+/// Returns the accuracy set by SetAccuracy()
+inline Accuracy GetAccuracy() {
+    return detail::accuracy.load(std::memory_order_relaxed);
+}
+
+/// e^x; for approximations results below the smallest normal float are 0 and results above
+/// e^88 (about 1.65e38) are e^88
+inline float Exp(float x, Accuracy accuracy) {
+    if (accuracy == Accuracy::Exact) {
+        return std::exp(x);
+    }
+    const float clamped = std::fmin(std::fmax(x, -87.3f), 88.0f);
+    const float underflow = x < -87.3f ? 0.0f : 1.0f;
+    if (accuracy == Accuracy::High) {
+        return detail::ExpPoly<7>(double(clamped)) * underflow;
+    }
+    return detail::ExpPoly<5>(clamped) * underflow;
+}
+
+/// Natural logarithm of x > 0 given as a normal float
+inline float Log(float x, Accuracy accuracy) {
+    if (accuracy == Accuracy::Exact) {
+        return std::log(x);
+    } else if (accuracy == Accuracy::High) {
+        return float(detail::LogPoly<6>(x));
+    }
+    return detail::LogFast(x);
+}
+
+namespace detail {
+
+/// x^y for x >= 0 by approximations; y is a double, so exact exponents like 1/3 stay accurate
+inline float PowPoly(float x, double y, Accuracy accuracy) {
+    const float positive = x > 0.0f ? 1.0f : 0.0f;
+    const float safe_x = std::fmax(x, 1e-37f);
+    if (accuracy == Accuracy::High) {
+        double exponent = std::fmin(std::fmax(y * LogPoly<6>(safe_x), -87.3), 88.0);
+        return ExpPoly<7>(exponent) * positive;
+    }
+    float exponent = std::fmin(std::fmax(float(y) * LogFast(safe_x), -87.3f), 88.0f);
+    return ExpPoly<5>(exponent) * positive;
+}
+
+/// Refines the cube root y of x by Halley's iterations, each one cubing the relative error
+template <int iterations>
+inline float HalleyCbrtSteps(float x, float y) {
+    if constexpr (iterations == 0) {
+        return y;
+    } else {
+        const float y3 = y * y * y;
+        return HalleyCbrtSteps<iterations - 1>(x, y * ((y3 + 2.0f * x) / (2.0f * y3 + x)));
+    }
+}
+
+/// Cube root of x >= 0: a first guess from the bits of x (exponent divided by 3) refined by
+/// Halley's iterations
+template <int iterations>
+inline float CbrtHalley(float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = bits / 3 + 0x2A514067u;
+    float y;
+    std::memcpy(&y, &bits, sizeof(y));
+    return x > 0.0f ? HalleyCbrtSteps<iterations>(x, y) : 0.0f;
+}
+
+}    // namespace detail
+
+/// x^y for x >= 0; the relative error of approximations holds for normal float x and results, see
+/// Exp() for the range of results
+inline float Pow(float x, float y, Accuracy accuracy) {
+    if (accuracy == Accuracy::Exact) {
+        return std::pow(x, y);
+    }
+    return detail::PowPoly(x, y, accuracy);
+}
+
+/// Cube root of x of any sign
+inline float Cbrt(float x, Accuracy accuracy) {
+    if (accuracy == Accuracy::Exact) {
+        return std::cbrt(x);
+    }
+    const float magnitude = std::fabs(x);
+    return std::copysign(accuracy == Accuracy::High ? detail::CbrtHalley<2>(magnitude)
+                                                    : detail::CbrtHalley<1>(magnitude),
+                         x);
+}
+
+/// e^x by <cmath> for values other than float
+template <typename T, std::enable_if_t<!std::is_same_v<T, float>, int> = 0>
+auto Exp(T x, Accuracy) {
+    return std::exp(x);
+}
+
+/// Natural logarithm by <cmath> for values other than float
+template <typename T, std::enable_if_t<!std::is_same_v<T, float>, int> = 0>
+auto Log(T x, Accuracy) {
+    return std::log(x);
+}
+
+/// x^y by <cmath> unless both x and y are floats
+template <typename T, typename U,
+          std::enable_if_t<!std::is_same_v<T, float> || !std::is_same_v<U, float>, int> = 0>
+auto Pow(T x, U y, Accuracy) {
+    return std::pow(x, y);
+}
+
+/// Cube root by <cmath> for values other than float
+template <typename T, std::enable_if_t<!std::is_same_v<T, float>, int> = 0>
+auto Cbrt(T x, Accuracy) {
+    return std::cbrt(x);
+}
+
+/// Calls func(accuracy) with the accuracy set by SetAccuracy() as a std::integral_constant, so
+/// the functions called by func with it are compiled for every accuracy without run-time checks.
+template <class Func>
+decltype(auto) WithAccuracy(Func&& func) {
+    switch (GetAccuracy()) {
+        case Accuracy::High:
+            return func(std::integral_constant<Accuracy, Accuracy::High>{});
+        case Accuracy::Fast:
+            return func(std::integral_constant<Accuracy, Accuracy::Fast>{});
+        default:
+            return func(std::integral_constant<Accuracy, Accuracy::Exact>{});
+    }
+}
+
+/// e^x with the accuracy set by SetAccuracy()
+inline float Exp(float x) {
+    return Exp(x, GetAccuracy());
+}
+
+/// Natural logarithm with the accuracy set by SetAccuracy()
+inline float Log(float x) {
+    return Log(x, GetAccuracy());
+}
+
+/// x^y for x >= 0 with the accuracy set by SetAccuracy()
+inline float Pow(float x, float y) {
+    return Pow(x, y, GetAccuracy());
+}
+
+/// Cube root with the accuracy set by SetAccuracy()
+inline float Cbrt(float x) {
+    return Cbrt(x, GetAccuracy());
+}
+
+}    // namespace pg::math
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace pg {
+
+/// Settings of the multi-threaded evaluation used by expression templates assignments and by
+/// per-pixel operations.
+struct ParallelSettings {
+    /// Number of threads of the built-in executor, including the calling one; 0 means
+    /// std::thread::hardware_concurrency()
+    int num_threads = 0;
+
+    /// Arrays with fewer elements than serial_threshold are processed by the calling thread only
+    std::size_t serial_threshold = std::size_t(1) << 18;
+
+    /// Size of a chunk of data processed by a thread at once, in bytes. The default fits in L2
+    /// cache of most CPUs.
+    std::size_t chunk_bytes = std::size_t(1) << 18;
+};
+
+/// Interface of executors running the parallel parts of the library operations.
+///
+/// Derive from the class to run the library on the thread pool of an application or a service.
+/// An executor must be safe to use from several threads and must outlive its use.
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    /// Returns the number of tasks which may run simultaneously; always >= 1.
+    virtual int GetConcurrency() const = 0;
+
+    /// Calls task(i) for every i in [0... num_of_tasks) and returns after all calls finish. The
+    /// calling thread may take part. task never throws; ParallelFor() catches exceptions itself.
+    virtual void Run(std::size_t num_of_tasks, const std::function<void(std::size_t)>& task) = 0;
+};
+
+/// Pool of persistent worker threads with work stealing.
+///
+/// Run() splits the tasks into contiguous blocks, one per thread, so neighbouring rows or chunks
+/// are processed by the same thread; a thread which finishes its block steals the remaining tasks
+/// of the other blocks one at a time. The calling thread takes part in the processing. The pool
+/// runs one Run() at a time: a call made while the pool is busy (e.g. from another thread) is
+/// executed serially by the calling thread.
+class ThreadPool : public Executor {
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+
+public:
+    /// @param num_threads Number of threads including the calling one; 0 means
+    /// std::thread::hardware_concurrency()
+    /// @param cpu_affinity CPUs the worker threads are pinned to: the i-th worker runs on
+    /// cpu_affinity[i % cpu_affinity.size()]. Empty means no pinning. Linux only; ignored
+    /// elsewhere.
+    explicit ThreadPool(int num_threads = 0, std::vector<int> cpu_affinity = {});
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() override;
+
+    int GetConcurrency() const override;
+    void Run(std::size_t num_of_tasks, const std::function<void(std::size_t)>& task) override;
+};
+
+/// Sets the library-wide settings of the multi-threaded evaluation. Changing num_threads
+/// recreates the built-in executor; do not call it while library operations are running.
+void SetParallelSettings(const ParallelSettings& settings);
+
+/// Returns the library-wide settings of the multi-threaded evaluation.
+ParallelSettings GetParallelSettings();
+
+/// Returns the executor used by ParallelFor(): the innermost ScopedExecutor of the calling thread
+/// if any, otherwise the one set by SetDefaultExecutor() or the built-in ThreadPool of
+/// ParallelSettings::num_threads threads.
+Executor* GetDefaultExecutor();
+
+/// Sets the executor used by ParallelFor(); nullptr restores the built-in one.
+void SetDefaultExecutor(Executor* executor);
+
+/// Makes an executor the default one for the calling thread during the lifetime of the object.
+///
+/// Example:
+/// @code
+/// pg::ThreadPool pool(4, {0, 1, 2, 3});
+/// pg::ScopedExecutor scoped(&pool);
+/// auto lab = pg::ImageFromSRGB(src, pg::ColorSpace::Lab);    // runs on the pool
+/// @endcode
+class ScopedExecutor {
+private:
+    Executor* previous_;
+
+public:
+    explicit ScopedExecutor(Executor* executor);
+    ScopedExecutor(const ScopedExecutor&) = delete;
+    ScopedExecutor& operator=(const ScopedExecutor&) = delete;
+    ~ScopedExecutor();
+};
+
+/// Returns the number of threads used by ParallelFor(); always >= 1.
+int GetNumThreads();
+
+/// Splits the [0... size) range into chunks of chunk_size elements (the last one may be smaller)
+/// and calls func(chunk_begin, chunk_end) for every chunk using GetDefaultExecutor(). Calls made
+/// from inside func are executed serially. The first exception thrown by func is rethrown after
+/// all chunks finish.
+void ParallelFor(std::size_t size, std::size_t chunk_size,
+                 const std::function<void(std::size_t, std::size_t)>& func);
+
+/// Calls func(begin, end) for the [0... size) range of items (e.g. pixels or rows), each covering
+/// item_elements elements of type T: serially if there are fewer than
+/// ParallelSettings::serial_threshold elements, otherwise with ParallelFor() using chunks of
+/// about ParallelSettings::chunk_bytes.
+template <typename T, class Func>
+void ParallelForItems(std::size_t size, std::size_t item_elements, Func&& func) {
+    const ParallelSettings settings = GetParallelSettings();
+    item_elements = std::max(item_elements, std::size_t(1));
+    if (size * item_elements < settings.serial_threshold) {
+        func(std::size_t(0), size);
+    } else {
+        ParallelFor(size, settings.chunk_bytes / (item_elements * sizeof(T)), func);
+    }
+}
+
+/// Splits a width x height area into tiles of tile_width x tile_height (tiles of the last row and
+/// column may be smaller) and calls func(x, y, tile_width, tile_height) for every tile in
+/// parallel.
+void ParallelForTiles(int width, int height, int tile_width, int tile_height,
+                      const std::function<void(int, int, int, int)>& func);
+
+}    // namespace pg
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "PhotoGoodyzer/ArrayView.h"
+#include "PhotoGoodyzer/Parallel.h"
+
+namespace pg {
+
+/// Mergeable streaming sketch of the distribution of values answering approximate quantile
+/// queries (merging <a href="https://arxiv.org/abs/1902.04023">t-digest</a>).
+///
+/// The sketch keeps about compression centroids (mean and weight of neighbouring values) however
+/// many values are inserted, so percentiles of huge or tiled images can be computed without
+/// holding a whole channel. Sketches of tiles or chunks are built independently and combined with
+/// Merge(). Centroids shrink towards the tails, so the rank error is relative to
+/// rank * (1 - rank) (@see GetNormalizedRankError()) and the 0.2/256 tails used for black and
+/// white points are resolved; the minimum and the maximum are exact. The same values inserted and
+/// merged in the same order give the same results.
+template <typename T>
+class QuantileSketch {
+private:
+    struct Centroid {
+        double mean;
+        double weight;
+
+        Centroid() = default;
+        Centroid(double mean, double weight = 1.0) : mean(mean), weight(weight) {}
+
+        bool operator<(const Centroid& other) const {
+            return mean < other.mean || (mean == other.mean && weight < other.weight);
+        }
+    };
+
+    static double MeanOf(const Centroid& centroid) { return centroid.mean; }
+    static double MeanOf(T value) { return double(value); }
+
+    double compression_;
+    std::uint64_t count_ = 0;
+    T min_val_ = T(0);
+    T max_val_ = T(0);
+    std::vector<Centroid> centroids_;
+    /// Centroids of merged sketches not yet combined with centroids_
+    std::vector<Centroid> unmerged_;
+    /// Inserted values not yet combined with centroids_
+    std::vector<T> buffer_;
+
+    double Normalizer() const {
+        return 4 * std::log(std::max(double(count_) / compression_, 1.0)) + 24;
+    }
+
+    /// Sorts values; floats are sorted by their bits, 8 bits per pass, which is several times
+    /// faster than comparisons for the buffer sizes of the sketch
+    static void Sort(std::vector<T>& values) {
+        if constexpr (std::is_same_v<T, float> && sizeof(float) == sizeof(std::uint32_t)) {
+            // Maps floats to unsigned integers of the same order
+            std::vector<std::uint32_t> keys(values.size());
+            std::vector<std::uint32_t> sorted(values.size());
+            for (size_t i = 0; i != values.size(); ++i) {
+                std::uint32_t bits;
+                std::memcpy(&bits, &values[i], sizeof(bits));
+                keys[i] = bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+            }
+            for (int shift = 0; shift != 32; shift += 8) {
+                size_t offsets[257] = {};
+                for (std::uint32_t key : keys) {
+                    ++offsets[((key >> shift) & 0xFF) + 1];
+                }
+                for (int i = 0; i != 256; ++i) {
+                    offsets[i + 1] += offsets[i];
+                }
+                for (std::uint32_t key : keys) {
+                    sorted[offsets[(key >> shift) & 0xFF]++] = key;
+                }
+                keys.swap(sorted);
+            }
+            for (size_t i = 0; i != values.size(); ++i) {
+                std::uint32_t bits = keys[i] & 0x80000000u ? keys[i] & 0x7FFFFFFFu : ~keys[i];
+                std::memcpy(&values[i], &bits, sizeof(bits));
+            }
+        } else {
+            std::sort(values.begin(), values.end());
+        }
+    }
+
+    /// Returns the centroids and values combined into as few centroids as the scale function k2
+    /// of the t-digest paper, log(rank / (1 - rank)) * compression_ / Normalizer(), allows; a
+    /// centroid spans at most one unit of it. Sorts values.
+    std::vector<Centroid> Compressed(std::vector<Centroid> centroids,
+                                     std::vector<T>& values) const {
+        std::sort(centroids.begin(), centroids.end());
+        Sort(values);
+        std::vector<Centroid> all(centroids.size() + values.size());
+        std::merge(centroids.begin(), centroids.end(), values.begin(), values.end(), all.begin(),
+                   [](const auto& a, const auto& b) { return MeanOf(a) < MeanOf(b); });
+        std::vector<Centroid> result;
+        if (all.empty()) {
+            return result;
+        }
+        const double total = double(count_);
+        const double max_span = Normalizer() / compression_;
+        double weight_before = 0.0;
+        double max_weight = 1.0;
+        // The mean of the current centroid is kept as the sum of values until it is complete
+        Centroid current(all[0].mean * all[0].weight, all[0].weight);
+        for (size_t i = 1; i != all.size(); ++i) {
+            if (current.weight + all[i].weight <= max_weight) {
+                current.mean += all[i].mean * all[i].weight;
+                current.weight += all[i].weight;
+            } else {
+                weight_before += current.weight;
+                result.emplace_back(current.mean / current.weight, current.weight);
+                current = Centroid(all[i].mean * all[i].weight, all[i].weight);
+                // The largest rank of a centroid starting at weight_before is the inverse of the
+                // scale function at one unit after the rank of weight_before
+                double rank = std::clamp(weight_before / total, 1e-12, 1 - 1e-12);
+                double scale = std::log(rank / (1 - rank)) + max_span;
+                max_weight = total / (1 + std::exp(-scale)) - weight_before;
+            }
+        }
+        result.emplace_back(current.mean / current.weight, current.weight);
+        return result;
+    }
+
+    void Compress() {
+        unmerged_.insert(unmerged_.end(), centroids_.begin(), centroids_.end());
+        centroids_ = Compressed(std::move(unmerged_), buffer_);
+        unmerged_.clear();
+        buffer_.clear();
+    }
+
+public:
+    /// @param compression Accuracy parameter; the rank error is inversely proportional to it, the
+    /// memory is proportional to it
+    explicit QuantileSketch(int compression = 200) : compression_(std::max(compression, 10)) {}
+
+    /// Returns the bound of the normalized rank error of a quantile: the rank span of a centroid
+    /// at that rank, (4 * ln(count / compression) + 24) / compression * rank * (1 - rank).
+    /// Interpolation between centroids keeps the error of smooth distributions well below it.
+    double GetNormalizedRankError(double rank) const {
+        return Normalizer() / compression_ * rank * (1 - rank);
+    }
+
+    /// Returns the number of inserted values
+    std::uint64_t GetCount() const { return count_; }
+
+    /// Returns the number of centroids kept by the sketch
+    size_t GetNumOfRetained() const {
+        return centroids_.size() + unmerged_.size() + buffer_.size();
+    }
+
+    void Insert(T value) {
+        if (count_ == 0) {
+            min_val_ = max_val_ = value;
+        } else {
+            min_val_ = std::min(min_val_, value);
+            max_val_ = std::max(max_val_, value);
+        }
+        ++count_;
+        buffer_.push_back(value);
+        if (buffer_.size() >= 5 * size_t(compression_)) {
+            Compress();
+        }
+    }
+
+    /// Inserts all values of a view row by row
+    void Insert(const ArrayView<const T>& view) {
+        view.ForEach([this](const T& value) { Insert(value); });
+    }
+
+    /// Adds the values of other sketch to the sketch, as if they were inserted into it.
+    void Merge(const QuantileSketch& other) {
+        if (other.count_ == 0) {
+            return;
+        }
+        if (count_ == 0) {
+            min_val_ = other.min_val_;
+            max_val_ = other.max_val_;
+        } else {
+            min_val_ = std::min(min_val_, other.min_val_);
+            max_val_ = std::max(max_val_, other.max_val_);
+        }
+        count_ += other.count_;
+        unmerged_.insert(unmerged_.end(), other.centroids_.begin(), other.centroids_.end());
+        unmerged_.insert(unmerged_.end(), other.unmerged_.begin(), other.unmerged_.end());
+        buffer_.insert(buffer_.end(), other.buffer_.begin(), other.buffer_.end());
+        Compress();
+    }
+
+    /// Returns a value of rank about rank * GetCount() in the sorted inserted values, interpolated
+    /// between the means of centroids; ranks 0 and 1 give the exact minimum and maximum. rank must
+    /// be between 0.0 and 1.0.
+    T GetQuantile(double rank) const {
+        if (rank < 0.0 || rank > 1.0) {
+            throw std::runtime_error("Rank must be between 0.0 and 1.0");
+        } else if (count_ == 0) {
+            throw std::runtime_error("The sketch is empty");
+        }
+        if (rank == 0.0) {
+            return min_val_;
+        } else if (rank == 1.0) {
+            return max_val_;
+        }
+        std::vector<Centroid> compressed = centroids_;
+        if (!unmerged_.empty() || !buffer_.empty()) {
+            compressed.insert(compressed.end(), unmerged_.begin(), unmerged_.end());
+            std::vector<T> values = buffer_;
+            compressed = Compressed(std::move(compressed), values);
+        }
+        // The minimum and the maximum are at the ranks 0 and count_, the mean of a centroid is at
+        // the middle of its ranks
+        const double target = rank * double(count_);
+        double prev_rank = 0.0;
+        double prev_value = double(min_val_);
+        double weight_before = 0.0;
+        for (const Centroid& centroid : compressed) {
+            const double cur_rank = weight_before + centroid.weight / 2;
+            if (target < cur_rank) {
+                double t = (target - prev_rank) / (cur_rank - prev_rank);
+                return T(prev_value + t * (centroid.mean - prev_value));
+            }
+            prev_rank = cur_rank;
+            prev_value = centroid.mean;
+            weight_before += centroid.weight;
+        }
+        double t = (target - prev_rank) / std::max(double(count_) - prev_rank, 1e-9);
+        return T(prev_value + t * (double(max_val_) - prev_value));
+    }
+
+    /// Returns [lower, upper] values corresponding to lower_b, upper_b percentile in decimal
+    /// form. @see Channel::Percentile()
+    std::pair<T, T> Percentile(float lower_b = 0.0f, float upper_b = 1.0f) const {
+        return {GetQuantile(lower_b), GetQuantile(upper_b)};
+    }
+};
+
+/// Builds a QuantileSketch of the viewed values. Blocks of rows are sketched in parallel and
+/// merged in a fixed order, so the result does not depend on the number of threads.
+template <typename T, typename Value = std::remove_const_t<T>>
+QuantileSketch<Value> MakeQuantileSketch(const ArrayView<T>& view, int compression = 200) {
+    const ParallelSettings settings = GetParallelSettings();
+    const size_t row_size = std::max(size_t(view.GetWidth()), size_t(1));
+    size_t block_rows = std::max(size_t(view.GetHeight()), size_t(1));
+    if (view.size() >= settings.serial_threshold) {
+        block_rows = std::max(settings.chunk_bytes / (row_size * sizeof(Value)), size_t(1));
+    }
+    const size_t num_of_blocks = (view.GetHeight() + block_rows - 1) / block_rows;
+    std::vector<QuantileSketch<Value>> sketches(num_of_blocks, QuantileSketch<Value>(compression));
+    ParallelFor(num_of_blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block != end; ++block) {
+            int y = int(block * block_rows);
+            int height = std::min(int(block_rows), view.GetHeight() - y);
+            sketches[block].Insert(view.Region(0, y, view.GetWidth(), height));
+        }
+    });
+    QuantileSketch<Value> result(compression);
+    for (const auto& sketch : sketches) {
+        result.Merge(sketch);
+    }
+    return result;
+}
+
+}    // namespace pg
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "../src/pglib/ImgExpr.h"
+#include "PhotoGoodyzer/Parallel.h"
+
+namespace pg {
+
+/// Number of elements reduced by a single task of Sum(), Mean(), Min(), Max() and MinMax().
+/// Partial results of tasks are combined in a fixed order, so the results do not depend on the
+/// number of threads.
+inline constexpr size_t REDUCTION_CHUNK = size_t(1) << 16;
+
+/// Type used to accumulate sums of values of type T: double for floating-point types, long long
+/// for integral types.
+template <class T>
+using ReductionSum_t = std::conditional_t<std::is_floating_point_v<T>, double, long long>;
+
+/// Type of the elements of an Array, an expression template or a std::vector
+template <class Operand>
+using ElementType_t = RemoveCVRef_t<decltype(std::declval<const Operand&>()[0])>;
+
+/// Reduces every channel of an operand in a single pass without materializing it.
+///
+/// The operand is split into chunks of about REDUCTION_CHUNK elements which are evaluated in
+/// packs (see ImgExpr::Batch()) by several threads; lane_op(accumulator, value) accumulates a
+/// value, combine(lhs, rhs) merges two accumulators. Element i belongs to the channel
+/// i % num_of_channels.
+/// @returns One accumulator per channel.
+template <class Acc, class Operand, class LaneOp, class Combine>
+std::vector<Acc> ReduceChannels(const Operand& src, int num_of_channels, Acc init, LaneOp lane_op,
+                                Combine combine) {
+    static_assert(has_size_and_idx<Operand>, "Only arrays and expressions can be reduced");
+    if (num_of_channels < 1 || src.size() % num_of_channels != 0) {
+        throw std::runtime_error("Size must be a multiple of the number of channels");
+    }
+    FlushOperand(src);
+    using V = ElementType_t<Operand>;
+    constexpr size_t N = PackSize<V>;
+    const size_t stride = size_t(num_of_channels);
+    // Chunks start at multiples of N * stride: then lane k of the a-th accumulator of a chunk
+    // always holds the channel (a * N + k) % stride.
+    const size_t chunk_size = std::max(REDUCTION_CHUNK / (N * stride), size_t(1)) * N * stride;
+    const size_t num_of_chunks = (src.size() + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<Acc>> partials(num_of_chunks);
+    auto reduce_chunk = [&](size_t begin, size_t end) {
+        std::vector<Pack<Acc, N>> lanes(stride);
+        for (auto& pack : lanes) {
+            for (size_t k = 0; k != N; ++k) {
+                pack[k] = init;
+            }
+        }
+        size_t i = begin;
+        for (size_t a = 0; i + N <= end; i += N) {
+            auto batch = SubscriptBatch<N>(src, i);
+            for (size_t k = 0; k != N; ++k) {
+                lanes[a][k] = lane_op(lanes[a][k], batch[k]);
+            }
+            a = (a + 1 == stride) ? 0 : a + 1;
+        }
+        std::vector<Acc> result(stride, init);
+        for (size_t a = 0; a != stride; ++a) {
+            for (size_t k = 0; k != N; ++k) {
+                size_t channel = (a * N + k) % stride;
+                result[channel] = combine(result[channel], lanes[a][k]);
+            }
+        }
+        for (; i < end; ++i) {
+            result[i % stride] = lane_op(result[i % stride], Subscript(src, i));
+        }
+        partials[begin / chunk_size] = std::move(result);
+    };
+    auto reduce_range = [&](size_t begin, size_t end) {
+        for (; begin < end; begin += chunk_size) {
+            reduce_chunk(begin, std::min(begin + chunk_size, end));
+        }
+    };
+    if (src.size() < GetParallelSettings().serial_threshold) {
+        reduce_range(0, src.size());
+    } else {
+        ParallelFor(src.size(), chunk_size, reduce_range);
+    }
+    // pairwise combination of partial results
+    for (size_t step = 1; step < num_of_chunks; step *= 2) {
+        for (size_t j = 0; j + step < num_of_chunks; j += 2 * step) {
+            for (size_t channel = 0; channel != stride; ++channel) {
+                partials[j][channel] = combine(partials[j][channel], partials[j + step][channel]);
+            }
+        }
+    }
+    return num_of_chunks == 0 ? std::vector<Acc>(stride, init) : std::move(partials[0]);
+}
+
+/// Returns sums of the channels of an Array or an expression template. Sums are accumulated in
+/// ReductionSum_t: every pack lane and every chunk is accumulated separately, and chunk sums are
+/// combined pairwise.
+/// @param src Array, expression template or std::vector
+/// @param num_of_channels Number of interleaved channels; element i belongs to the channel
+/// i % num_of_channels
+template <class Operand, class = std::enable_if_t<has_size_and_idx<Operand>>>
+std::vector<ReductionSum_t<ElementType_t<Operand>>> Sum(const Operand& src,
+                                                        int num_of_channels = 1) {
+    using S = ReductionSum_t<ElementType_t<Operand>>;
+    auto add = [](S acc, S value) { return acc + value; };
+    return ReduceChannels<S>(src, num_of_channels, S(0), add, add);
+}
+
+/// Returns mean values of the channels of an Array or an expression template.
+/// @see Sum()
+template <class Operand, class = std::enable_if_t<has_size_and_idx<Operand>>>
+std::vector<double> Mean(const Operand& src, int num_of_channels = 1) {
+    auto sums = Sum(src, num_of_channels);
+    std::vector<double> result(sums.size());
+    double num_of_elements = double(src.size()) / num_of_channels;
+    for (size_t i = 0; i != sums.size(); ++i) {
+        result[i] = double(sums[i]) / num_of_elements;
+    }
+    return result;
+}
+
+/// Returns minimal values of the channels of an Array or an expression template.
+/// @see Sum()
+template <class Operand, class = std::enable_if_t<has_size_and_idx<Operand>>>
+std::vector<ElementType_t<Operand>> Min(const Operand& src, int num_of_channels = 1) {
+    using V = ElementType_t<Operand>;
+    if (src.size() == 0) {
+        throw std::runtime_error("Cannot find the minimum of an empty array");
+    }
+    auto min = [](V lhs, V rhs) { return rhs < lhs ? rhs : lhs; };
+    return ReduceChannels<V>(src, num_of_channels, std::numeric_limits<V>::max(), min, min);
+}
+
+/// Returns maximal values of the channels of an Array or an expression template.
+/// @see Sum()
+template <class Operand, class = std::enable_if_t<has_size_and_idx<Operand>>>
+std::vector<ElementType_t<Operand>> Max(const Operand& src, int num_of_channels = 1) {
+    using V = ElementType_t<Operand>;
+    if (src.size() == 0) {
+        throw std::runtime_error("Cannot find the maximum of an empty array");
+    }
+    auto max = [](V lhs, V rhs) { return lhs < rhs ? rhs : lhs; };
+    return ReduceChannels<V>(src, num_of_channels, std::numeric_limits<V>::lowest(), max, max);
+}
+
+/// Returns <min1, max1, min2, max2 ...> values of the channels of an Array or an expression
+/// template in a single pass.
+/// @see Sum()
+template <class Operand, class = std::enable_if_t<has_size_and_idx<Operand>>>
+std::vector<ElementType_t<Operand>> MinMax(const Operand& src, int num_of_channels = 1) {
+    using V = ElementType_t<Operand>;
+    if (src.size() == 0) {
+        throw std::runtime_error("Cannot find the minimum and maximum of an empty array");
+    }
+    auto min_max = ReduceChannels<Pack<V, 2>>(
+        src, num_of_channels,
+        Pack<V, 2>{{std::numeric_limits<V>::max(), std::numeric_limits<V>::lowest()}},
+        [](const Pack<V, 2>& acc, V value) {
+            return Pack<V, 2>{{value < acc[0] ? value : acc[0], acc[1] < value ? value : acc[1]}};
+        },
+        [](const Pack<V, 2>& lhs, const Pack<V, 2>& rhs) {
+            return Pack<V, 2>{
+                {rhs[0] < lhs[0] ? rhs[0] : lhs[0], lhs[1] < rhs[1] ? rhs[1] : lhs[1]}};
+        });
+    std::vector<V> result(min_max.size() * 2);
+    for (size_t i = 0; i != min_max.size(); ++i) {
+        result[2 * i] = min_max[i][0];
+        result[2 * i + 1] = min_max[i][1];
+    }
+    return result;
+}
+
+}    // namespace pg
@@ -8,25 +8,89 @@
 /// <a href="https://doi.org/10.1002/col.22131">CAM16</a> Color Appearance Models, for example local
 /// lightness adaptation, color temperature correction, etc. Currently these functions support
 /// Image<float> and Channel<float> classes with default deleters only, therefore one may need
-/// to convert existing data in the specified classes to implement them.
+/// to convert existing data in the specified classes to implement them. Results and temporaries
+/// are allocated from GetDefaultResource(); wrap calls in a ScopedResource with a ScratchArena to
+/// recycle the buffers between images of the same size. Per-pixel loops run on
+/// GetDefaultExecutor(); wrap calls in a ScopedExecutor to run them on a pool of the application.
 namespace pg::ops {
 
+/// Kinds of histogram equalization used by GetEqualizedXYZFromLab()
+enum struct Equalization {
+    Global,      ///< A single histogram of the whole channel
+    Adaptive,    ///< Contrast-limited adaptive histogram equalization, see EqualizeAdaptive()
+};
+
+/// Implementations of Gaussian blur used by ApplyGaussianBlur()
+enum struct BlurBackend {
+    Auto,         ///< Chosen by the size of the channel and the width of the kernel
+    FFT,          ///< Fourier transform of the channel padded with reflected fields
+    DCT,          ///< Discrete cosine transform, see ApplyGaussianBlurDCT()
+    Recursive,    ///< Recursive (IIR) filter, see ApplyGaussianBlurRecursive()
+    Tiled,        ///< Overlap-save convolution of tiles, see ApplyGaussianBlurTiled()
+};
+
+/// Resolutions at which LocLightAdapt() blurs the luminance to get the adaptation map
+enum struct AdaptationQuality {
+    Preview,         ///< About 128 px along the smaller side; the map is interpolated per pixel
+    Intermediate,    ///< About 1024 px along the smaller side; the map is interpolated per pixel
+    Full,            ///< The resolution of the image; no interpolation, so no halos from it
+};
+
+/// Evaluations of the response curves of CAMCompress(), CAMDecompress() and LocLightAdapt()
+enum struct CurveEvaluation {
+    Default,      ///< The one set by SetCurveEvaluation(), CurveEvaluation::Exact initially
+    Exact,        ///< math::Pow() with the accuracy set by math::SetAccuracy() for every value
+    Tabulated,    ///< Powers interpolated in tables indexed by the binary exponent and mantissa;
+                  ///< the relative error of the powers and the curves is below 1e-6 for gammas
+                  ///< between 1/3 and 3; the curves are evaluated about 2-3 times faster
+};
+
+/// Parameters of contrast-limited adaptive histogram equalization (CLAHE)
+struct CLAHESettings {
+    /// Number of tiles along the width of a channel
+    int tiles_x = 8;
+
+    /// Number of tiles along the height of a channel
+    int tiles_y = 8;
+
+    /// Maximal count of a histogram bin relative to the mean count; the excess is redistributed
+    /// among all bins. Values <= 1 give no contrast enhancement, large values give ordinary
+    /// adaptive equalization.
+    float clip_limit = 2.0f;
+
+    /// Number of bins of tile histograms
+    int num_of_bins = 256;
+};
+
 /// Resizes the channel to the desired dimensions; currently works only for Channel<float> using
 /// stb_image_resize.h.
 Array<float> Resize(const Array<float>& other, int new_width, int new_height);
 
 /// Performs advanced gamma compresiion based on iCam06, CAM16 model; images must be in
-/// ColorSpace::LMS. // Currently works only for Image<float> and Channel<float>
+/// ColorSpace::LMS. The matrices must have equal dimensions, which may be lower than the ones of
+/// the image: they are interpolated bilinearly row by row while the image is compressed, so
+/// smooth maps need not be upsampled. Currently works only for Image<float> and Channel<float>
 Image<float> CAMCompress(const Image<float>& src, const Channel<float>& adapt_matrix,
-                         const Channel<float>& ref_white, float gamma);
+                         const Channel<float>& ref_white, float gamma,
+                         CurveEvaluation evaluation = CurveEvaluation::Default);
 
 /// Performs gamma decompresiion based on iCam06, CAM16 model; images must be in ColorSpace::LMS.
 /// Currently works only for Image<float> and Channel<float>
-Image<float> CAMDecompress(const Image<float>& LMS, float gamma);
+Image<float> CAMDecompress(const Image<float>& LMS, float gamma,
+                           CurveEvaluation evaluation = CurveEvaluation::Default);
+
+/// Sets the evaluation of response curves used by CurveEvaluation::Default; it must be Exact or
+/// Tabulated.
+void SetCurveEvaluation(CurveEvaluation evaluation);
 
-/// Performs local lightness adaptation (reduces local over/under exposion); images must be in
-/// ColorSpace::XYZ. Currently works only for Image<float>
-Image<float> LocLightAdapt(const Image<float>& XYZ);
+/// Returns the evaluation of response curves used by CurveEvaluation::Default.
+CurveEvaluation GetCurveEvaluation();
+
+/// Performs local lightness adaptation (reduces local over/under exposion) in a single pass over
+/// rows; images must be in ColorSpace::XYZ. Higher qualities blur the map with
+/// ApplyGaussianBlurTiled(). Currently works only for Image<float>
+Image<float> LocLightAdapt(const Image<float>& XYZ,
+                           AdaptationQuality quality = AdaptationQuality::Preview);
 
 /// Correct apparent illuminant temperature to D65; images must be in
 /// ColorSpace::Lab. Currently works only for Image<float>
@@ -35,8 +99,33 @@ Image<float> CorrectColorTemperature(const Image<float>& img_lab_src);
 /// Computes the distance map from the channel; Currently works only for Channel<float>
 Channel<float> MakeDistMap(const Channel<float>& other);
 
-/// Applies Gaussian Blur to the channel. Currently works only for Channel<float>
-Channel<float> ApplyGaussianBlur(const Channel<float>& src, int scale_parameter = 2);
+/// Applies Gaussian Blur exp(-(d * scale_parameter / max_dim)^2) to the channel; BlurBackend::Auto
+/// picks the recursive filter for kernels narrower than 1/6 of the channel and the DCT otherwise.
+/// Currently works only for Channel<float>
+Channel<float> ApplyGaussianBlur(const Channel<float>& src, int scale_parameter = 2,
+                                 BlurBackend backend = BlurBackend::Auto);
+
+/// Applies Gaussian Blur to every channel of the image, see
+/// @ref ApplyGaussianBlur(const Channel<float>&, int, BlurBackend). With BlurBackend::FFT the
+/// padded channels are transformed as a batch by single executions of a plan. Currently works
+/// only for Image<float>
+Image<float> ApplyGaussianBlur(const Image<float>& src, int scale_parameter = 2,
+                               BlurBackend backend = BlurBackend::Auto);
+
+/// Applies Gaussian Blur to the channel using the discrete cosine transform, which reflects the
+/// borders without padding. Currently works only for Channel<float>
+Channel<float> ApplyGaussianBlurDCT(const Channel<float>& src, int scale_parameter = 2);
+
+/// Applies Gaussian Blur to the channel with the recursive (IIR) filter of van Vliet, Young and
+/// Verbeek, whose cost does not depend on the kernel width; the standard deviation must be at
+/// least 0.5 pixels. Currently works only for Channel<float>
+Channel<float> ApplyGaussianBlurRecursive(const Channel<float>& src, int scale_parameter = 2);
+
+/// Applies Gaussian Blur to the channel by overlap-save convolution of row and column segments,
+/// so the memory per thread grows with the larger dimension only. Currently works only for
+/// Channel<float>
+Channel<float> ApplyGaussianBlurTiled(const Channel<float>& src, int scale_parameter = 2,
+                                      int tile_size = 256);
 
 /// Downscale the channel to the target size. Currently works only for Channel<float>
 Channel<float> Downscale(const Channel<float>& other, int target_size = 128);
@@ -45,22 +134,52 @@ Channel<float> Downscale(const Channel<float>& other, int target_size = 128);
 /// only for Channel<float>
 Channel<float> PadReflect(const Channel<float>& other, int add_width, int add_height);
 
+/// Pads a channel with fields of given widths reflected to the channel on every side; fields
+/// wider than the channel are reflected repeatedly. Currently works only for Channel<float>
+Channel<float> PadReflect(const Channel<float>& other, int add_left, int add_top, int add_right,
+                          int add_bottom);
+
 /// Computes iCAM06 based adaptation matrix used for @ref IPTAdapt(const Image<float>&, float).
 /// Currently works only for Channel<float>
 Channel<float> GetAdaptMatrix(const Channel<float>& white);
 
-/// Performs iCam06 based IPT adaptation; images must be in ColorSpace::XYZ. Currently works only
-/// for Channel<float>
+/// Performs iCam06 based IPT adaptation; images must be in ColorSpace::XYZ. The adaptation
+/// factor of every pixel is computed from its luminance as by GetAdaptMatrix(), and the round
+/// trip through ColorSpace::LMS and ColorSpace::IPT is made a row at a time in a single parallel
+/// pass, which also finds the maximum luminance of the result; normalizing by it is the only other
+/// pass. Currently works only for Image<float>
 Image<float> IPTAdapt(const Image<float>& XYZ, float max_L = 16250.0f);
 
+/// Correct black and white points in source ColorSpace::RGB or ColorSpace::XYZ image and
+/// transforms it to ColorSpace::Lab in-place. @see LocLightAdapt() for quality. Currently works
+/// only for Image<float>
+void ConvertRgbToBWCorrectedLab(Image<float>& img_rgb,
+                                AdaptationQuality quality = AdaptationQuality::Preview);
+
 /// Correct black and white points in source ColorSpace::RGB image, transforms it to
-/// ColorSpace::Lab and returns the lightness channel. Currently works only for Channel<float> and
-/// Image<float>
-Channel<float> RgbToBWCorrectedLab(Image<float>& img_rgb);
+/// ColorSpace::Lab and returns a copy of the lightness channel. Currently works only for
+/// Channel<float> and Image<float>
+Channel<float> RgbToBWCorrectedLab(Image<float>& img_rgb,
+                                   AdaptationQuality quality = AdaptationQuality::Preview);
 
 /// Performs histogram equalization of the lightness channel, copies it to the source
 /// ColorSpace::Lab image and transforms the image to ColorSpace::XYZ. Currently works only for
 /// Channel<float> and Image<float>
 Image<float> GetEqualizedXYZFromLab(const Image<float>& src_Lab, Channel<float>& lightness);
 
+/// Performs histogram equalization of the lightness channel of a ColorSpace::Lab image in a copy
+/// of the image and transforms the copy to ColorSpace::XYZ. Currently works only for Image<float>
+Image<float> GetEqualizedXYZFromLab(const Image<float>& src_Lab,
+                                    Equalization mode = Equalization::Global,
+                                    const CLAHESettings& settings = {});
+
+/// Performs contrast-limited adaptive histogram equalization (CLAHE) of the viewed values in
+/// place, mapping them to the [out_min... out_max] range.
+///
+/// Histograms of tiles are computed in parallel and clipped to settings.clip_limit; every value
+/// is mapped by bilinear interpolation between the cumulative histograms of the four nearest
+/// tiles. Currently works only for float values.
+void EqualizeAdaptive(const ArrayView<float>& view, float out_min, float out_max,
+                      const CLAHESettings& settings = {});
+
 }    // namespace pg::ops
@@ -25,6 +25,23 @@ inline unsigned char linRGB_to_sRGB(float value) {
     }
 }
 
+/// Returns the table of 256 thresholds of sRGB encoding: the k-th threshold is the minimal float
+/// linear RGB value which linRGB_to_sRGB(float) encodes to k or greater (the 0-th one is 0).
+/// The table is computed once at the first call.
+const float* GetSRGBThresholds();
+
+/// Convert a float linear RGB [0... 1] value to an unsigned char sRGB [0... 255] value with a
+/// branchless binary search in the thresholds returned by GetSRGBThresholds(). Gives the same
+/// results as linRGB_to_sRGB(float) without calling std::pow; values outside the [0... 1] range
+/// are clipped.
+inline unsigned char linRGB_to_sRGB(float value, const float* thresholds) {
+    int code = 0;
+    for (int step = 128; step != 0; step /= 2) {
+        code += (value >= thresholds[code + step]) ? step : 0;
+    }
+    return (unsigned char)code;
+}
+
 ///// Convert type2 sRGB value to type1 linear RGB [0... 1] value using formula.
 // template <typename T1, typename T2>
 // inline T1 sRGB_to_linRGB(T2 value) {
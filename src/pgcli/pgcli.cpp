@@ -1,5 +1,7 @@
 #include <filesystem>
 #include <iostream>
+#include <memory>
+#include <utility>
 
 #include "PhotoGoodyzer.h"
 
@@ -52,14 +54,48 @@ Image<unsigned char> ReadFromFile(const char* filename_ptr) {
     std::vector<std::filesystem::path> src_filepaths;
     std::filesystem::path out_dir = argv[0];
     out_dir = out_dir.parent_path();
-    if (argc == 1) {
-        std::cerr << "Usage: pgcli [image1.jpg image2.jpg ..] destination_directory(optional)"
+    // Options precede file paths
+    Equalization equalization = Equalization::Global;
+    AdaptationQuality quality = AdaptationQuality::Preview;
+    std::unique_ptr<WisdomFile> wisdom;
+    int first_path = 1;
+    for (; first_path != argc; ++first_path) {
+        std::filesystem::path option = argv[first_path];
+        if (option == "--clahe") {
+            equalization = Equalization::Adaptive;
+        } else if (option == "--fine") {
+            quality = AdaptationQuality::Intermediate;
+        } else if (option == "--full") {
+            quality = AdaptationQuality::Full;
+        } else if (option == "--wisdom") {
+            if (++first_path == argc) {
+                break;    // no file follows, the usage is printed below
+            }
+            // Measured plans are reused by every image and by the next runs
+            wisdom = std::make_unique<WisdomFile>(
+                std::filesystem::path(argv[first_path]).string());
+            SetPlanRigor(PlanRigor::Measure);
+        } else {
+            break;
+        }
+    }
+    if (argc == first_path) {
+        std::cerr << "Usage: pgcli [--clahe] [--fine | --full] [--wisdom file] "
+                     "[image1.jpg image2.jpg ..] destination_directory(optional)"
+                  << std::endl;
+        std::cerr << "  --clahe        use contrast-limited adaptive histogram equalization"
+                  << std::endl;
+        std::cerr << "  --fine         compute the lightness adaptation map at 1024 px"
+                  << std::endl;
+        std::cerr << "  --full         compute the lightness adaptation map at full resolution"
+                  << std::endl;
+        std::cerr << "  --wisdom file  measure FFT plans, keeping FFTW wisdom in the file"
                   << std::endl;
         return -1;
-    } else if (argc == 2) {
-        src_filepaths.push_back(argv[1]);
+    } else if (argc == first_path + 1) {
+        src_filepaths.push_back(argv[first_path]);
     } else {
-        for (int i = 1; i != argc - 1; ++i) {
+        for (int i = first_path; i != argc - 1; ++i) {
             src_filepaths.push_back(argv[i]);
         }
         std::filesystem::path last_path = argv[argc - 1];
@@ -70,36 +106,32 @@ Image<unsigned char> ReadFromFile(const char* filename_ptr) {
             std::filesystem::create_directories(out_dir);
         }
     }
+    ScratchArena arena;    // recycles full-resolution temporaries between images of a size
+    std::pair<int, int> arena_size(0, 0);
     for (const auto& src_filepath : src_filepaths) {
+        ScopedResource scratch(&arena);
         std::cout << "Processing: " << src_filepath << std::endl;
         std::filesystem::path out_file_no_extension = out_dir / src_filepath.stem();
-        Image<float> img_float = LinRGBFromSRGB(ReadFromFile(src_filepath.string().c_str()));
-        Image<float> eq;
-        {
-            Channel<float> lightness = RgbToBWCorrectedLab(img_float);
-            {    // May be parralel
-                Image<float> bw_ct = CorrectColorTemperature(img_float);
-                bw_ct.ChangeColorSpace(ColorSpace::XYZ);
-                bw_ct.ChangeColorSpace(ColorSpace::RGB);
-                Write(SRGBFromLinRGB(bw_ct),
-                      (out_file_no_extension.string() + "_BWcorr.bmp").c_str());
-            }
-            eq = GetEqualizedXYZFromLab(img_float, lightness);
+        Image<float> img_float = ImageFromSRGB(ReadFromFile(src_filepath.string().c_str()),
+                                               ColorSpace::XYZ, Layout::Planar);
+        // Cached buffers of another size would never be reused
+        if (std::make_pair(img_float.GetWidth(), img_float.GetHeight()) != arena_size) {
+            arena.Release();
+            arena_size = {img_float.GetWidth(), img_float.GetHeight()};
         }
-        eq = IPTAdapt(eq, 1.0f);
-        {    // May be Parallel
-            img_float.ChangeColorSpace(ColorSpace::XYZ);
-            img_float.ChangeColorSpace(ColorSpace::RGB);
-            Write(SRGBFromLinRGB(img_float),
-                  (out_file_no_extension.string() + "_BWcorr_CTcorr.bmp").c_str());
+        ConvertRgbToBWCorrectedLab(img_float, quality);
+        {    // May be parralel
+            Image<float> bw_ct = CorrectColorTemperature(img_float);
+            Write(SRGBFromImage(bw_ct), (out_file_no_extension.string() + "_BWcorr.bmp").c_str());
         }
-        Write(SRGBFromLinRGB(Image<float>(eq, ColorSpace::RGB)),
-              (out_file_no_extension.string() + "_HistEQ.bmp").c_str());
+        Image<float> eq = GetEqualizedXYZFromLab(img_float, equalization);
+        eq = IPTAdapt(eq, 1.0f);
+        Write(SRGBFromImage(img_float),
+              (out_file_no_extension.string() + "_BWcorr_CTcorr.bmp").c_str());
+        Write(SRGBFromImage(eq), (out_file_no_extension.string() + "_HistEQ.bmp").c_str());
         eq.ChangeColorSpace(ColorSpace::Lab);
         eq = CorrectColorTemperature(eq);
-        eq.ChangeColorSpace(ColorSpace::XYZ);
-        eq.ChangeColorSpace(ColorSpace::RGB);
-        Write(SRGBFromLinRGB(eq), (out_file_no_extension.string() + "_HistEQ_CTcorr.bmp").c_str());
+        Write(SRGBFromImage(eq), (out_file_no_extension.string() + "_HistEQ_CTcorr.bmp").c_str());
     }
 
     // std::cin.get();
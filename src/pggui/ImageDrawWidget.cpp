@@ -188,34 +188,27 @@ void ImageDrawWidget::ResetCachedImages() {
 
 void ImageDrawWidget::ProcessSrcImg(const QImage& src_qimg) {
     auto bw = std::make_unique<ImageFloat>(ImageFloatFromQImage(src_qimg));
-    auto lightness = std::make_unique<pg::Channel<float>>(pg::ops::RgbToBWCorrectedLab(*bw));
+    pg::ops::ConvertRgbToBWCorrectedLab(*bw);
     emit ProgressValue(25);
     QFuture<void> ct_future = QtConcurrent::run([&bw, this]() {
         ImageFloat bw_ct = pg::ops::CorrectColorTemperature(*bw);
-        bw_ct.ChangeColorSpace(pg::ColorSpace::XYZ);
-        bw_ct.ChangeColorSpace(pg::ColorSpace::RGB);
         FillCache(bw_ct_corrected, bw_ct_corr_pg, bw_ct);
         emit ProgressValue(31);
     });
-    auto eq = std::make_unique<ImageFloat>(pg::ops::GetEqualizedXYZFromLab(*bw, *lightness));
-    lightness.reset();
+    auto eq = std::make_unique<ImageFloat>(pg::ops::GetEqualizedXYZFromLab(*bw));
     *eq = pg::ops::IPTAdapt(*eq, 1.0f);
     emit ProgressValue(58);
     ct_future.waitForFinished();
 
     QFuture<void> bw_future = QtConcurrent::run([&bw, this]() {
-        bw->ChangeColorSpace(pg::ColorSpace::XYZ);
-        bw->ChangeColorSpace(pg::ColorSpace::RGB);
         FillCache(bw_corrected, bw_corr_pg, *bw);
         bw.reset();
         emit ProgressValue(72);
     });
-    FillCache(hist_eq_corrected, hist_eq_corr_pg, ImageFloat(*eq, pg::ColorSpace::RGB));
+    FillCache(hist_eq_corrected, hist_eq_corr_pg, *eq);
     eq->ChangeColorSpace(pg::ColorSpace::Lab);
     *eq = pg::ops::CorrectColorTemperature(*eq);
     emit ProgressValue(88);
-    eq->ChangeColorSpace(pg::ColorSpace::XYZ);
-    eq->ChangeColorSpace(pg::ColorSpace::RGB);
     FillCache(hist_eq_ct_corrected, hist_eq_ct_corr_pg, *eq);
     eq.reset();
     bw_future.waitForFinished();
@@ -226,10 +219,10 @@ void ImageDrawWidget::ProcessSrcImg(const QImage& src_qimg) {
 }
 
 void ImageDrawWidget::FillCache(std::unique_ptr<QImage>& dst_qimg,
-                                std::unique_ptr<ImageUchar>& dst_uchar, const ImageFloat& src_RGB) {
-    dst_uchar = std::make_unique<ImageUchar>(pg::ColorSpace::sRGB, src_RGB.GetWidth(),
-                                             src_RGB.GetHeight(), src_RGB.GetNumOfChannels());
-    pg::SRGBFromLinRGB(*dst_uchar, src_RGB);
+                                std::unique_ptr<ImageUchar>& dst_uchar, const ImageFloat& src) {
+    dst_uchar = std::make_unique<ImageUchar>(pg::ColorSpace::sRGB, src.GetWidth(),
+                                             src.GetHeight(), src.GetNumOfChannels());
+    pg::SRGBFromImage(*dst_uchar, src);
     dst_qimg = std::make_unique<QImage>(
         dst_uchar->begin(), dst_uchar->GetWidth(), dst_uchar->GetHeight(),
         int(dst_uchar->GetWidth() * 3 * sizeof(uchar)), QImage::Format::Format_RGB888);
@@ -45,7 +45,7 @@ private:
     void ResetCachedImages();
     void ProcessSrcImg(const QImage& src_qimg);
     void FillCache(std::unique_ptr<QImage>& dst_qimg, std::unique_ptr<ImageUchar>& dst_uchar,
-                   const ImageFloat& src_XYZ);
+                   const ImageFloat& src);
     void DrawAllLayers(QPainter& painter, const QRect& target_r, const QRect& src_r);
     void RedrawResult();
 
@@ -0,0 +1,111 @@
+#include "PhotoGoodyzer/Allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+
+namespace pg {
+
+namespace {
+
+std::atomic<MemoryResource*> default_resource = nullptr;
+
+thread_local MemoryResource* scoped_resource = nullptr;
+
+}    // namespace
+
+AlignedResource::AlignedResource(std::size_t huge_page_threshold) :
+    huge_page_threshold_(huge_page_threshold) {}
+
+std::size_t AlignedResource::ActualAlignment(std::size_t bytes, std::size_t alignment) const {
+    if (huge_page_threshold_ != 0 && bytes >= huge_page_threshold_) {
+        return std::max(alignment, HUGE_PAGE_SIZE);
+    }
+    return alignment;
+}
+
+void* AlignedResource::Allocate(std::size_t bytes, std::size_t alignment) {
+    alignment = ActualAlignment(bytes, alignment);
+    void* ptr = ::operator new(bytes, std::align_val_t(alignment));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (alignment >= HUGE_PAGE_SIZE) {
+        // only a hint: the kernel may still use regular pages
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+}
+
+void AlignedResource::Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+    ::operator delete(ptr, std::align_val_t(ActualAlignment(bytes, alignment)));
+}
+
+ScratchArena::ScratchArena(MemoryResource* upstream) :
+    upstream_(upstream ? upstream : GetDefaultResource()) {}
+
+ScratchArena::~ScratchArena() {
+    Release();
+}
+
+void* ScratchArena::Allocate(std::size_t bytes, std::size_t alignment) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = cached_.find({bytes, alignment});
+        if (iter != cached_.end() && !iter->second.empty()) {
+            void* ptr = iter->second.back();
+            iter->second.pop_back();
+            cached_bytes_ -= bytes;
+            return ptr;
+        }
+    }
+    return upstream_->Allocate(bytes, alignment);
+}
+
+void ScratchArena::Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cached_[{bytes, alignment}].push_back(ptr);
+    cached_bytes_ += bytes;
+}
+
+void ScratchArena::Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [size_and_alignment, buffers] : cached_) {
+        for (void* ptr : buffers) {
+            upstream_->Deallocate(ptr, size_and_alignment.first, size_and_alignment.second);
+        }
+    }
+    cached_.clear();
+    cached_bytes_ = 0;
+}
+
+std::size_t ScratchArena::GetCachedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+}
+
+MemoryResource* GetDefaultResource() {
+    static AlignedResource builtin_resource;
+    if (scoped_resource) {
+        return scoped_resource;
+    }
+    MemoryResource* resource = default_resource.load();
+    return resource ? resource : &builtin_resource;
+}
+
+void SetDefaultResource(MemoryResource* resource) {
+    default_resource = resource;
+}
+
+ScopedResource::ScopedResource(MemoryResource* resource) : previous_(scoped_resource) {
+    scoped_resource = resource;
+}
+
+ScopedResource::~ScopedResource() {
+    scoped_resource = previous_;
+}
+
+}    // namespace pg
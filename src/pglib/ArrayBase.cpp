@@ -2,12 +2,13 @@
 
 namespace pg {
 
-ArrayBase::ArrayBase(int width, int height, int num_of_channels) :
+ArrayBase::ArrayBase(int width, int height, int num_of_channels, Layout layout) :
     width_(width),
     height_(height),
     img_size_(width * height),
     num_of_channels_(num_of_channels),
-    array_size_(width * height * num_of_channels) {}
+    array_size_(width * height * num_of_channels),
+    layout_(layout) {}
 
 size_t ArrayBase::size() const {
     return array_size_;
@@ -28,4 +29,17 @@ int ArrayBase::GetNumOfChannels() const {
     return num_of_channels_;
 }
 
+Layout ArrayBase::GetLayout() const {
+    return layout_;
+}
+
+std::size_t ArrayBase::GetPixelStride() const {
+    return layout_ == Layout::Planar ? 1 : std::size_t(num_of_channels_);
+}
+
+std::size_t ArrayBase::GetChannelOffset(int channel_bias) const {
+    return layout_ == Layout::Planar ? std::size_t(channel_bias) * img_size_
+                                     : std::size_t(channel_bias);
+}
+
 }    // namespace pg
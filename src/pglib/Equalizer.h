@@ -1,52 +1,85 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
-namespace pg {
+#include "PhotoGoodyzer/ArrayView.h"
+#include "PhotoGoodyzer/Parallel.h"
 
-template <typename T>
-class Channel;
+namespace pg {
 
+/// Histogram of values of an ArrayView used for percentiles and histogram equalization.
+///
+/// The [0... max] range of non-negative values (the [min... max] range otherwise) is split into
+/// quantize + 1 bins; every bin keeps the number of values and their exact minimum and maximum.
+/// Histograms of chunks of rows are counted in parallel and merged, so the memory does not depend
+/// on the number of values.
 template <typename T>
 class Equalizer {
 private:
-    std::map<int, std::vector<T*>> unq_val_to_iter;
+    struct Bin {
+        size_t count = 0;
+        T min;
+        T max;
+    };
+
     const int quantize_;
     const size_t size_;
     T min_val_;
     T max_val_;
+    T offset_;
+    T range_;
+    std::vector<Bin> bins_;
 
-    T MinInVec(const std::vector<T*>& vec) const {
-        T min = max_val_;
-        for (auto ptr : vec) {
-            if (*ptr < min) {
-                min = *ptr;
-            }
-        }
-        return min;
+    /// Returns the bin of a value in the [min_val_... max_val_] range
+    int BinOf(T value) const {
+        return range_ > 0 ? std::min(int((value - offset_) / range_ * quantize_), quantize_) : 0;
     }
 
-    T MaxInVec(const std::vector<T*>& vec) const {
-        T max = min_val_;
-        for (auto ptr : vec) {
-            if (*ptr > max) {
-                max = *ptr;
-            }
+    /// Calls func(row_begin, row_end) for rows of the view in parallel
+    template <class Func>
+    static void ForRows(const ArrayView<const T>& view, Func func) {
+        ParallelForItems<T>(view.GetHeight(), view.GetWidth(), func);
+    }
+
+    /// Returns the index of the first non-empty bin after i in the direction step (1 or -1)
+    int NextBin(int i, int step) const {
+        for (i += step; i >= 0 && i <= quantize_ && bins_[i].count == 0; i += step) {
         }
-        return max;
+        return i;
     }
 
 public:
-    Equalizer(const Channel<T>& other, int quantize = 1000) :
+    Equalizer(const ArrayView<const T>& other, int quantize = 1000) :
         quantize_(quantize), size_(other.size()) {
-        auto min_max = MinMaxValues(other);
+        auto min_max = MinMax(other);
         min_val_ = min_max[0];
         max_val_ = min_max[1];
-        for (auto iter = other.begin(); iter != other.end(); ++iter) {
-            unq_val_to_iter[int(*iter / max_val_ * quantize_)].push_back(iter);
-        }
+        offset_ = min_val_ >= 0 ? T(0) : min_val_;
+        range_ = max_val_ - offset_;
+        bins_.assign(quantize_ + 1, Bin{0, max_val_, min_val_});
+        std::mutex merge_mutex;
+        ForRows(other, [this, &other, &merge_mutex](size_t row_begin, size_t row_end) {
+            std::vector<Bin> local(bins_.size(), Bin{0, max_val_, min_val_});
+            for (size_t y = row_begin; y != row_end; ++y) {
+                const T* ptr = &other.At(0, int(y));
+                for (int x = 0; x != other.GetWidth(); ++x) {
+                    T value = ptr[x * other.GetPixelStride()];
+                    Bin& bin = local[BinOf(value)];
+                    ++bin.count;
+                    bin.min = std::min(bin.min, value);
+                    bin.max = std::max(bin.max, value);
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (size_t i = 0; i != bins_.size(); ++i) {
+                bins_[i].count += local[i].count;
+                bins_[i].min = std::min(bins_[i].min, local[i].min);
+                bins_[i].max = std::max(bins_[i].max, local[i].max);
+            }
+        });
     }
 
     T FindLowerPercentile(float bound = 0.0f) const {
@@ -55,18 +88,16 @@ public:
         }
         float cur_ratio = 0.0f;
         float prev_ratio = 0.0f;
-        for (auto map_iter = unq_val_to_iter.begin(); map_iter != unq_val_to_iter.end();
-             ++map_iter) {
-            cur_ratio += float(map_iter->second.size()) / size_;
+        const int first = NextBin(-1, 1);
+        for (int i = first, prev = -1; i <= quantize_; prev = i, i = NextBin(i, 1)) {
+            cur_ratio += float(bins_[i].count) / size_;
             if (cur_ratio > bound) {
-                if (map_iter == unq_val_to_iter.begin()) {
+                if (i == first) {
                     return min_val_;
+                } else if ((bound - prev_ratio) < (cur_ratio - bound)) {
+                    return bins_[prev].max;
                 } else {
-                    if ((bound - prev_ratio) < (cur_ratio - bound)) {
-                        return MaxInVec(std::prev(map_iter)->second);
-                    } else {
-                        return MinInVec(map_iter->second);
-                    }
+                    return bins_[i].min;
                 }
             }
             prev_ratio = cur_ratio;
@@ -81,18 +112,16 @@ public:
         bound = 1.0f - bound;
         float cur_ratio = 0.0f;
         float prev_ratio = 0.0f;
-        for (auto map_iter = unq_val_to_iter.rbegin(); map_iter != unq_val_to_iter.rend();
-             ++map_iter) {
-            cur_ratio += float(map_iter->second.size()) / size_;
+        const int last = NextBin(quantize_ + 1, -1);
+        for (int i = last, prev = -1; i >= 0; prev = i, i = NextBin(i, -1)) {
+            cur_ratio += float(bins_[i].count) / size_;
             if (cur_ratio > bound) {
-                if (map_iter == unq_val_to_iter.rbegin()) {
+                if (i == last) {
                     return max_val_;
+                } else if ((bound - prev_ratio) < (cur_ratio - bound)) {
+                    return bins_[prev].min;
                 } else {
-                    if ((bound - prev_ratio) < (cur_ratio - bound)) {
-                        return MinInVec(std::prev(map_iter)->second);
-                    } else {
-                        return MaxInVec(map_iter->second);
-                    }
+                    return bins_[i].max;
                 }
             }
             prev_ratio = cur_ratio;
@@ -100,18 +129,39 @@ public:
         return min_val_;
     }
 
-    void ExportEqualized(Channel<T>& dst, float out_min, float out_max) const {
+    /// Returns a lookup table of equalized values: the i-th entry is the value of the i-th bin.
+    std::vector<T> GetEqualizedLUT(float out_min, float out_max) const {
+        std::vector<T> lut(bins_.size());
+        const int first = NextBin(-1, 1);
+        const size_t num_of_darkest = first <= quantize_ ? bins_[first].count : 0;
+        size_t cum_sum = 0;
+        for (size_t i = 0; i != bins_.size(); ++i) {
+            cum_sum += bins_[i].count;
+            size_t rank = cum_sum > num_of_darkest ? cum_sum - num_of_darkest : 0;
+            lut[i] = float(rank) / size_ * (out_max - out_min) + out_min;
+        }
+        return lut;
+    }
+
+    /// Writes equalized values to the data the equalizer was constructed from; dst must view
+    /// that data, unchanged since the construction.
+    void ExportEqualized(const ArrayView<T>& dst, float out_min, float out_max) const {
         if (size_ != dst.size()) {
             throw std::runtime_error("EQ: Sizes of input and output channels must be equal");
         }
-        int cum_sum = 0;
-        int num_of_darkest = int(unq_val_to_iter.begin()->second.size());
-        for (const auto& [unique_value, iterators] : unq_val_to_iter) {
-            cum_sum += int(iterators.size());
-            for (auto iter : iterators) {
-                *iter = float(cum_sum - num_of_darkest) / size_ * (out_max - out_min) + out_min;
-            }
+        if (size_ == 0) {
+            return;
         }
+        const std::vector<T> lut = GetEqualizedLUT(out_min, out_max);
+        ForRows(dst, [this, &dst, &lut](size_t row_begin, size_t row_end) {
+            for (size_t y = row_begin; y != row_end; ++y) {
+                T* ptr = &dst.At(0, int(y));
+                for (int x = 0; x != dst.GetWidth(); ++x) {
+                    T& value = ptr[x * dst.GetPixelStride()];
+                    value = lut[BinOf(value)];
+                }
+            }
+        });
     }
 };
 
@@ -4,54 +4,361 @@
 #include <fftw3.h>
 
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <stdexcept>
+#include <tuple>
 
 #include "PhotoGoodyzer/Array.h"
+#include "PhotoGoodyzer/FFTPlans.h"
+#include "PhotoGoodyzer/Parallel.h"
 
 namespace pg {
 
+namespace {
+
+// r2c and c2r out-of-place transforms; in-place DCT-II (REDFT10) and DCT-III (REDFT01)
+enum struct Direction { Forward, Backward, ForwardDCT, InverseDCT };
+
+// Plans are keyed by (width, height, number of planes, direction, SIMD alignment of real data,
+// rigor, number of threads)
+using PlanKey = std::tuple<int, int, int, Direction, bool, PlanRigor, int>;
+
+// The FFTW planner and wisdom functions are not thread-safe; executing plans is
+std::mutex planner_mutex;
+std::atomic<PlanRigor> plan_rigor = PlanRigor::Estimate;
+std::atomic<bool> multi_threaded = true;
+
+#ifdef PG_FFTW_THREADS
+// Runs the parallel loops of multi-threaded plans on the library executor, so the transforms
+// share the threads of the other operations; loops of transforms called from parallel tasks run
+// serially
+void RunParallelLoop(void* (*work)(char*), char* job_data, size_t job_size, int num_of_jobs,
+                     void*) {
+    ParallelFor(size_t(num_of_jobs), 1, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+            work(job_data + i * job_size);
+        }
+    });
+}
+
+#endif
+
+// Initializes multi-threaded FFTW before planning or importing wisdom; must be called with
+// planner_mutex locked
+void InitThreads() {
+#ifdef PG_FFTW_THREADS
+    static bool initialized = false;
+    if (!initialized) {
+        if (!fftwf_init_threads()) {
+            throw std::runtime_error("Cannot initialize FFTW threads");
+        }
+        fftwf_threads_set_callback(RunParallelLoop, nullptr);
+        initialized = true;
+    }
+#endif
+}
+
+struct PlanCache {
+    std::map<PlanKey, fftwf_plan> plans;
+
+    ~PlanCache() { Clear(); }
+
+    void Clear() {
+        for (auto& [key, plan] : plans) {
+            fftwf_destroy_plan(plan);
+        }
+        plans.clear();
+    }
+};
+
+PlanCache plan_cache;
+
+unsigned PlannerFlags(PlanRigor rigor) {
+    switch (rigor) {
+        case PlanRigor::Measure:
+            return FFTW_MEASURE;
+        case PlanRigor::Patient:
+            return FFTW_PATIENT;
+        default:
+            return FFTW_ESTIMATE;
+    }
+}
+
+// Returns a cached plan for count planes of data of the alignment of real_data, creating it if
+// needed. Plans are created on scratch arrays since measuring overwrites them; they are executed
+// with the new-array execute functions.
+fftwf_plan GetPlan(int width, int height, int count, Direction direction, float* real_data) {
+    const bool aligned = fftwf_alignment_of(real_data) == 0;
+    const PlanRigor rigor = plan_rigor;
+    const int num_of_threads = IsMultiThreadedFFT() ? GetNumThreads() : 1;
+    const PlanKey key(width, height, count, direction, aligned, rigor, num_of_threads);
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    auto iter = plan_cache.plans.find(key);
+    if (iter != plan_cache.plans.end()) {
+        return iter->second;
+    }
+    InitThreads();
+#ifdef PG_FFTW_THREADS
+    fftwf_plan_with_nthreads(num_of_threads);
+#endif
+    unsigned flags = PlannerFlags(rigor) | (aligned ? 0 : FFTW_UNALIGNED);
+    const int real_size = width * height;
+    const int complex_size = height * (width / 2 + 1);
+    std::unique_ptr<float[], void (*)(float*)> real(fftwf_alloc_real(size_t(real_size) * count),
+                                                    [](float* p) { fftwf_free(p); });
+    std::unique_ptr<fftwf_complex[], void (*)(fftwf_complex*)> complex(
+        fftwf_alloc_complex(size_t(complex_size) * count),
+        [](fftwf_complex* p) { fftwf_free(p); });
+    const int dims[2] = {height, width};
+    fftwf_plan plan = nullptr;
+    if (direction == Direction::Forward) {
+        plan = fftwf_plan_many_dft_r2c(2, dims, count, real.get(), nullptr, 1, real_size,
+                                       complex.get(), nullptr, 1, complex_size, flags);
+    } else if (direction == Direction::Backward) {
+        plan = fftwf_plan_many_dft_c2r(2, dims, count, complex.get(), nullptr, 1, complex_size,
+                                       real.get(), nullptr, 1, real_size, flags);
+    } else {
+        fftwf_r2r_kind kind = direction == Direction::ForwardDCT ? FFTW_REDFT10 : FFTW_REDFT01;
+        plan = fftwf_plan_r2r_2d(height, width, real.get(), real.get(), kind, kind, flags);
+    }
+    if (!plan) {
+        throw std::runtime_error("Cannot create an FFTW plan");
+    }
+    plan_cache.plans.emplace(key, plan);
+    return plan;
+}
+
+// Returns the index of the value at i in a line of n values reflected at its ends as by
+// PadReflect(), i.e. about the first and the last values, as many times as needed
+int Reflect(int i, int n) {
+    if (n == 1) {
+        return 0;
+    }
+    while (i < 0 || i >= n) {
+        i = i < 0 ? -i : 2 * n - 2 - i;
+    }
+    return i;
+}
+
+// Convolves num_of_lines lines of length values, the i-th value of the line l at
+// l * line_stride + i * element_stride, with the kernel by overlap-save of segments. Groups of
+// lines are read into a buffer before their results are written, so src may be dst.
+void ConvolveLines(const float* src, float* dst, int length, int num_of_lines,
+                   size_t element_stride, size_t line_stride, const std::vector<float>& kernel,
+                   int radius, int tile_size) {
+    // Lines transformed by a single plan execution; columns of a group are read row by row
+    constexpr int GROUP = 16;
+    using RealBuffer = std::unique_ptr<float[], void (*)(float*)>;
+    using ComplexBuffer = std::unique_ptr<fftwf_complex[], void (*)(fftwf_complex*)>;
+    auto alloc_real = [](size_t size) {
+        return RealBuffer(fftwf_alloc_real(size), [](float* p) { fftwf_free(p); });
+    };
+    auto alloc_complex = [](size_t size) {
+        return ComplexBuffer(fftwf_alloc_complex(size), [](fftwf_complex* p) { fftwf_free(p); });
+    };
+    // At least half of every transform is output
+    const int segment = std::min(length, std::max({tile_size, 2 * radius, 1}));
+    const int size = GetFastFFTSize(segment + 2 * radius);
+    const int complex_size = size / 2 + 1;
+    // Spectrum of the kernel moved to the origin of the periodic line and normalized by the size
+    // of the inverse transform
+    RealBuffer real = alloc_real(size);
+    ComplexBuffer spectrum = alloc_complex(complex_size);
+    std::fill(real.get(), real.get() + size, 0.0f);
+    for (int i = 0; i <= 2 * radius; ++i) {
+        real[(i - radius + size) % size] = kernel[i] / float(size);
+    }
+    fftwf_execute_dft_r2c(GetPlan(size, 1, 1, Direction::Forward, real.get()), real.get(),
+                          spectrum.get());
+    fftwf_plan forward = GetPlan(size, 1, GROUP, Direction::Forward, real.get());
+    fftwf_plan backward = GetPlan(size, 1, GROUP, Direction::Backward, real.get());
+    // Reflected indices of the values transformed for every segment
+    const int num_of_segments = (length + segment - 1) / segment;
+    std::vector<int> indices(size_t(num_of_segments) * size);
+    for (int s = 0; s != num_of_segments; ++s) {
+        for (int j = 0; j != size; ++j) {
+            indices[size_t(s) * size + j] = Reflect(s * segment - radius + j, length);
+        }
+    }
+    const size_t num_of_groups = (size_t(num_of_lines) + GROUP - 1) / GROUP;
+    ParallelForItems<float>(num_of_groups, size_t(GROUP) * length, [&](size_t begin, size_t end) {
+        std::vector<float> lines(size_t(GROUP) * length, 0.0f);
+        RealBuffer region = alloc_real(size_t(GROUP) * size);
+        ComplexBuffer product = alloc_complex(size_t(GROUP) * complex_size);
+        for (size_t group = begin; group != end; ++group) {
+            const int first = int(group) * GROUP;
+            const int count = std::min(GROUP, num_of_lines - first);
+            for (int i = 0; i != length; ++i) {
+                const float* values = src + first * line_stride + i * element_stride;
+                for (int l = 0; l != count; ++l) {
+                    lines[size_t(l) * length + i] = values[l * line_stride];
+                }
+            }
+            for (int s = 0; s != num_of_segments; ++s) {
+                const int* segment_indices = indices.data() + size_t(s) * size;
+                for (int l = 0; l != GROUP; ++l) {
+                    const float* line = lines.data() + size_t(l) * length;
+                    float* values = region.get() + size_t(l) * size;
+                    for (int j = 0; j != size; ++j) {
+                        values[j] = line[segment_indices[j]];
+                    }
+                }
+                fftwf_execute_dft_r2c(forward, region.get(), product.get());
+                for (int l = 0; l != GROUP; ++l) {
+                    fftwf_complex* values = product.get() + size_t(l) * complex_size;
+                    for (int k = 0; k != complex_size; ++k) {
+                        float re = values[k][0] * spectrum[k][0] - values[k][1] * spectrum[k][1];
+                        float im = values[k][0] * spectrum[k][1] + values[k][1] * spectrum[k][0];
+                        values[k][0] = re;
+                        values[k][1] = im;
+                    }
+                }
+                fftwf_execute_dft_c2r(backward, product.get(), region.get());
+                // Circular convolution is exact for the values at least radius from the ends
+                const int start = s * segment;
+                const int segment_length = std::min(segment, length - start);
+                for (int i = 0; i != segment_length; ++i) {
+                    float* values = dst + first * line_stride + (start + i) * element_stride;
+                    for (int l = 0; l != count; ++l) {
+                        values[l * line_stride] = region[size_t(l) * size + radius + i];
+                    }
+                }
+            }
+        }
+    });
+}
+
+}    // namespace
+
+void SetPlanRigor(PlanRigor rigor) {
+    plan_rigor = rigor;
+}
+
+PlanRigor GetPlanRigor() {
+    return plan_rigor;
+}
+
+void SetMultiThreadedFFT(bool enabled) {
+    multi_threaded = enabled;
+}
+
+bool IsMultiThreadedFFT() {
+#ifdef PG_FFTW_THREADS
+    return multi_threaded;
+#else
+    return false;
+#endif
+}
+
+std::size_t GetNumOfCachedPlans() {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    return plan_cache.plans.size();
+}
+
+void ClearPlanCache() {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    plan_cache.Clear();
+}
+
+bool ImportWisdom(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    InitThreads();
+    return fftwf_import_wisdom_from_filename(filename.c_str()) != 0;
+}
+
+bool ExportWisdom(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    InitThreads();
+    return fftwf_export_wisdom_to_filename(filename.c_str()) != 0;
+}
+
+WisdomFile::WisdomFile(std::string filename) : filename_(std::move(filename)) {
+    ImportWisdom(filename_);
+}
+
+WisdomFile::~WisdomFile() {
+    ExportWisdom(filename_);
+}
+
+int GetFastFFTSize(int size) {
+    for (int candidate = std::max(size, 1);; ++candidate) {
+        int rest = candidate;
+        for (int factor : {2, 3, 5, 7}) {
+            while (rest % factor == 0) {
+                rest /= factor;
+            }
+        }
+        if (rest == 1) {
+            return candidate;
+        }
+    }
+}
+
+void ConvolveTiled(const float* src, float* dst, int width, int height,
+                   const std::vector<float>& kernel, int radius, int tile_size) {
+    if (kernel.size() != size_t(2 * radius + 1)) {
+        throw std::runtime_error("Kernel size must be 2 * radius + 1");
+    }
+    // Rows from src to dst, then columns of dst in-place
+    ConvolveLines(src, dst, width, height, 1, size_t(width), kernel, radius, tile_size);
+    ConvolveLines(dst, dst, height, width, size_t(width), 1, kernel, radius, tile_size);
+}
+
+void ForwardDCT(float* data, int width, int height) {
+    fftwf_plan plan = GetPlan(width, height, 1, Direction::ForwardDCT, data);
+    fftwf_execute_r2r(plan, data, data);
+}
+
+void InverseDCT(float* data, int width, int height) {
+    fftwf_plan plan = GetPlan(width, height, 1, Direction::InverseDCT, data);
+    fftwf_execute_r2r(plan, data, data);
+}
+
 class FFTImpl {
 public:
     std::unique_ptr<float[], void (*)(float*)> in_;
     fftwf_complex* out_;
-    const fftwf_plan plan_fwd;
-    const fftwf_plan plan_bwd;
     const int width_;
     const int height_;
     const int size_;
+    const int count_;
 
     // Copying ctor and with OUT data out-of-place;
     FFTImpl(const Array<float>& other) :
-        in_(fftwf_alloc_real(other.GetImgSize()), [](float* p) { fftwf_free(p); }),
-        out_(fftwf_alloc_complex(other.GetHeight() * (other.GetWidth() / 2 + 1))),
-        plan_fwd(fftwf_plan_dft_r2c_2d(other.GetHeight(), other.GetWidth(), InBegin(), OutBegin(),
-                                       FFTW_ESTIMATE)),
-        plan_bwd(fftwf_plan_dft_c2r_2d(other.GetHeight(), other.GetWidth(), OutBegin(), InBegin(),
-                                       FFTW_ESTIMATE)),
+        in_(fftwf_alloc_real(other.size()), [](float* p) { fftwf_free(p); }),
+        out_(fftwf_alloc_complex(other.GetNumOfChannels() * other.GetHeight() *
+                                 (other.GetWidth() / 2 + 1))),
         width_(other.GetWidth()),
         height_(other.GetHeight()),
-        size_(other.GetImgSize()) {
+        size_(other.GetImgSize()),
+        count_(other.GetNumOfChannels()) {
+        if (count_ != 1 && other.GetLayout() != Layout::Planar) {
+            fftwf_free(out_);
+            throw std::runtime_error("Channels must be planar");
+        }
         std::copy(other.begin(), other.end(), InBegin());
     }
 
     // Non-Copying non-destructive ctor, with OUT data out-of-place
-    FFTImpl(float* in, int width, int height) :
+    FFTImpl(float* in, int width, int height, int count) :
         in_(in, [](float*) {}),
-        out_(fftwf_alloc_complex(height * (width / 2 + 1))),
-        plan_fwd(fftwf_plan_dft_r2c_2d(height, width, InBegin(), OutBegin(), FFTW_ESTIMATE)),
-        plan_bwd(fftwf_plan_dft_c2r_2d(height, width, OutBegin(), InBegin(), FFTW_ESTIMATE)),
+        out_(fftwf_alloc_complex(count * height * (width / 2 + 1))),
         width_(width),
         height_(height),
-        size_(width * height) {}
+        size_(width * height),
+        count_(count) {}
+
+    // Number of complex values of a plane of OUT data
+    int OutPlaneSize() const { return height_ * (width_ / 2 + 1); }
 
     float* InBegin() const { return in_.get(); }
-    float* InEnd() const { return std::next(in_.get(), size_); }
+    float* InEnd() const { return std::next(in_.get(), size_ * count_); }
     fftwf_complex* OutBegin() const { return out_; }
-    fftwf_complex* OutEnd() const { return std::next(out_, height_ * (width_ / 2 + 1)); }
+    fftwf_complex* OutEnd() const { return std::next(out_, OutPlaneSize() * count_); }
 
     ~FFTImpl() {
-        fftwf_destroy_plan(plan_fwd);
-        fftwf_destroy_plan(plan_bwd);
         // fftwf_free(in_);
         fftwf_free(out_);
     }
@@ -59,14 +366,19 @@ public:
 
 FFTr2c::FFTr2c(const Array<float>& other) : impl(new FFTImpl(other)) {}
 
-FFTr2c::FFTr2c(float* in, int width, int height) : impl(new FFTImpl(in, width, height)) {}
+FFTr2c::FFTr2c(float* in, int width, int height, int count) :
+    impl(new FFTImpl(in, width, height, count)) {}
 
 void FFTr2c::ForwardTransform() {
-    fftwf_execute(impl->plan_fwd);
+    fftwf_plan plan = GetPlan(impl->width_, impl->height_, impl->count_, Direction::Forward,
+                              impl->InBegin());
+    fftwf_execute_dft_r2c(plan, impl->InBegin(), impl->OutBegin());
 }
 
 void FFTr2c::InverseTransform() {
-    fftwf_execute(impl->plan_bwd);
+    fftwf_plan plan = GetPlan(impl->width_, impl->height_, impl->count_, Direction::Backward,
+                              impl->InBegin());
+    fftwf_execute_dft_c2r(plan, impl->OutBegin(), impl->InBegin());
     this->NormalizeIn();
 }
 
@@ -78,10 +390,13 @@ void FFTr2c::NormalizeIn() {
 }
 
 void FFTr2c::RemoveOutZeroFreq() {
-    float value = (*impl->OutBegin())[0];
-    auto out_end = impl->OutEnd();
-    for (auto iter = impl->OutBegin(); iter != out_end; ++iter) {
-        (*iter)[0] /= value;
+    for (int plane = 0; plane != impl->count_; ++plane) {
+        auto out_begin = std::next(impl->OutBegin(), plane * impl->OutPlaneSize());
+        auto out_end = std::next(out_begin, impl->OutPlaneSize());
+        float value = (*out_begin)[0];
+        for (auto iter = out_begin; iter != out_end; ++iter) {
+            (*iter)[0] /= value;
+        }
     }
 }
 
@@ -93,22 +408,51 @@ void FFTr2c::ReduceImagine() {
 }
 
 void FFTr2c::LoadTo(Array<float>& other) {
-    if (impl->size_ != other.GetImgSize()) {
+    if (size_t(impl->size_) * impl->count_ != other.size()) {
         throw std::runtime_error("Sizes do not match");
     }
     std::copy(impl->InBegin(), impl->InEnd(), other.begin());
 }
 
 void FFTr2c::MultiplyOutByRealOut(const FFTr2c& other) {
-    if (impl->width_ != other.impl->width_ || impl->height_ != other.impl->height_) {
+    if (impl->width_ != other.impl->width_ || impl->height_ != other.impl->height_ ||
+        (other.impl->count_ != 1 && other.impl->count_ != impl->count_)) {
         throw std::runtime_error("Sizes do not match");
     }
-    auto other_iter = other.impl->OutBegin();
     auto this_out_end = impl->OutEnd();
+    auto other_iter = other.impl->OutBegin();
+    auto other_out_end = other.impl->OutEnd();
     for (auto this_iter = impl->OutBegin(); this_iter != this_out_end; ++this_iter) {
         (*this_iter)[0] *= (*other_iter)[0];
         (*this_iter)[1] *= (*other_iter)[0];
-        ++other_iter;
+        if (++other_iter == other_out_end) {
+            other_iter = other.impl->OutBegin();
+        }
+    }
+}
+
+std::vector<float> FFTr2c::GetOutReal() const {
+    std::vector<float> result(impl->OutEnd() - impl->OutBegin());
+    auto iter = impl->OutBegin();
+    for (auto& value : result) {
+        value = (*iter++)[0];
+    }
+    return result;
+}
+
+void FFTr2c::MultiplyOutByReal(const std::vector<float>& factors) {
+    const size_t out_size = impl->OutEnd() - impl->OutBegin();
+    if (factors.size() != out_size && factors.size() != size_t(impl->OutPlaneSize())) {
+        throw std::runtime_error("Sizes do not match");
+    }
+    auto factor_iter = factors.begin();
+    auto out_end = impl->OutEnd();
+    for (auto iter = impl->OutBegin(); iter != out_end; ++iter) {
+        (*iter)[0] *= *factor_iter;
+        (*iter)[1] *= *factor_iter;
+        if (++factor_iter == factors.end()) {
+            factor_iter = factors.begin();
+        }
     }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include "PhotoGoodyzer/Array.h"
 
@@ -8,6 +9,26 @@ namespace pg {
 
 class FFTImpl;
 
+// Returns the smallest size >= size with no prime factors but 2, 3, 5 and 7; FFTW transforms
+// such sizes with its fastest algorithms
+int GetFastFFTSize(int size);
+
+// Convolves the width x height row-major channel src with the separable kernel of 2 * radius + 1
+// values, along rows and then along columns, and writes the result to dst, which may be src; src
+// is reflected at its borders as PadReflect() does. Overlap-save: lines are cut into segments of
+// tile_size values, or 2 * radius if longer, convolved in parallel for groups of lines with
+// Fourier transforms of (segment + 2 * radius) values, so the memory per thread is proportional
+// to the larger dimension, not to the size of the channel.
+void ConvolveTiled(const float* src, float* dst, int width, int height,
+                   const std::vector<float>& kernel, int radius, int tile_size);
+
+// In-place 2D DCT-II (FFTW_REDFT10) of row-major data
+void ForwardDCT(float* data, int width, int height);
+
+// In-place 2D DCT-III (FFTW_REDFT01), the inverse of ForwardDCT() up to the factor
+// 4 * width * height
+void InverseDCT(float* data, int width, int height);
+
 class FFTr2c {
 private:
     std::unique_ptr<FFTImpl> impl;
@@ -15,11 +36,13 @@ private:
 public:
     FFTr2c() = delete;
 
-    // Copying ctor and with OUT data out-of-place;
+    // Copying ctor and with OUT data out-of-place; channels of a planar array are transformed as
+    // a batch
     FFTr2c(const Array<float>& other);
 
-    // Non-Copying non-destructive ctor, with OUT data out-of-place
-    FFTr2c(float* in, int width, int height);
+    // Non-Copying non-destructive ctor, with OUT data out-of-place. A batch of count planes of
+    // width * height values stored one after another is transformed by a single plan execution.
+    FFTr2c(float* in, int width, int height, int count = 1);
 
     void ForwardTransform();
     void InverseTransform();
@@ -29,6 +52,11 @@ public:
 
     void LoadTo(Array<float>& other);
     void MultiplyOutByRealOut(const FFTr2c& other);
+
+    // Real parts of OUT data, height * (width / 2 + 1) values per plane
+    std::vector<float> GetOutReal() const;
+    // Multiplies OUT data by factors of all planes or of one plane, which are used for every plane
+    void MultiplyOutByReal(const std::vector<float>& factors);
     void ClipNegativeOutRealToZero();
     void ClipNegativeInToZero();
 
@@ -1,21 +1,19 @@
 #include "PhotoGoodyzer/Image.h"
 
+#include <array>
 #include <stdexcept>
 
 #include "PhotoGoodyzer/sRGBvLinRGB.h"
+#include "XYZvLab.h"
 
 namespace pg {
 
-Image<float> LinRGBFromSRGB(const Image<unsigned char>& src_sRGB) {
+Image<float> LinRGBFromSRGB(const Image<unsigned char>& src_sRGB, Layout layout) {
     if (src_sRGB.GetColorSpace() != ColorSpace::sRGB)
         throw std::runtime_error("Source image must be in sRGB");
-    Image<float> img(ColorSpace::RGB, src_sRGB.GetWidth(), src_sRGB.GetHeight(),
+    Image<float> img(ColorSpace::RGB, layout, src_sRGB.GetWidth(), src_sRGB.GetHeight(),
                      src_sRGB.GetNumOfChannels());
-    auto this_ptr = img.begin();
-    auto src_ptr = src_sRGB.begin();
-    size_t array_size = img.size();
-    for (size_t _ = 0; _ != array_size; ++_)
-        *this_ptr++ = sRGB_to_linRGB(*src_ptr++);
+    ConvertArray(src_sRGB, img, [](unsigned char value) { return sRGB_to_linRGB(value); });
     return img;
 }
 
@@ -24,42 +22,110 @@ Image<unsigned char> SRGBFromLinRGB(const Image<float>& src_rgb) {
         throw std::runtime_error("Source image must be in Linear RGB");
     Image<unsigned char> img(ColorSpace::sRGB, src_rgb.GetWidth(), src_rgb.GetHeight(),
                              src_rgb.GetNumOfChannels());
-    auto this_ptr = img.begin();
-    auto src_ptr = src_rgb.begin();
-    size_t array_size = img.size();
-    for (size_t _ = 0; _ != array_size; ++_)
-        *this_ptr++ = linRGB_to_sRGB(*src_ptr++);
+    ConvertArray(src_rgb, img, [thresholds = GetSRGBThresholds()](float value) {
+        return linRGB_to_sRGB(value, thresholds);
+    });
     return img;
 }
 
-void LinRGBFromSRGB(Image<float>& dst_linRGB,
-                    const Image<unsigned char>& src_sRGB) {
+void LinRGBFromSRGB(Image<float>& dst_linRGB, const Image<unsigned char>& src_sRGB) {
     if (src_sRGB.GetColorSpace() != ColorSpace::sRGB)
         throw std::runtime_error("Source image must be in sRGB");
     if (dst_linRGB.GetColorSpace() != ColorSpace::RGB)
         throw std::runtime_error("Destination image must be in Linear RGB");
     if (!AreEqualDimensions(dst_linRGB, src_sRGB))
         throw std::runtime_error("Dimensions must be equal");
-    auto dst_ptr = dst_linRGB.begin();
-    auto src_ptr = src_sRGB.begin();
-    size_t array_size = dst_linRGB.size();
-    for (size_t _ = 0; _ != array_size; ++_)
-        *dst_ptr++ = sRGB_to_linRGB(*src_ptr++);
+    ConvertArray(src_sRGB, dst_linRGB,
+                 [](unsigned char value) { return sRGB_to_linRGB(value); });
 }
 
-void SRGBFromLinRGB(Image<unsigned char>& dst_sRGB,
-                    const Image<float>& src_linRGB) {
+void SRGBFromLinRGB(Image<unsigned char>& dst_sRGB, const Image<float>& src_linRGB) {
     if (src_linRGB.GetColorSpace() != ColorSpace::RGB)
         throw std::runtime_error("Source image must be in Linear RGB");
     if (dst_sRGB.GetColorSpace() != ColorSpace::sRGB)
         throw std::runtime_error("Destination image must be in sRGB");
     if (!AreEqualDimensions(dst_sRGB, src_linRGB))
         throw std::runtime_error("Dimensions must be equal");
-    auto dst_ptr = dst_sRGB.begin();
-    auto src_ptr = src_linRGB.begin();
-    size_t array_size = dst_sRGB.size();
-    for (size_t _ = 0; _ != array_size; ++_)
-        *dst_ptr++ = linRGB_to_sRGB(*src_ptr++);
+    ConvertArray(src_linRGB, dst_sRGB, [thresholds = GetSRGBThresholds()](float value) {
+        return linRGB_to_sRGB(value, thresholds);
+    });
+}
+
+Image<float> ImageFromSRGB(const Image<unsigned char>& src_sRGB, ColorSpace desired_clrs,
+                           Layout layout) {
+    if (src_sRGB.GetColorSpace() != ColorSpace::sRGB)
+        throw std::runtime_error("Source image must be in sRGB");
+    if (src_sRGB.GetNumOfChannels() != 3)
+        throw std::runtime_error("Only 3-channel images are supported");
+    Image<float> dst(desired_clrs, layout, src_sRGB.GetWidth(), src_sRGB.GetHeight(), 3);
+    const float* lut = UCHAR_TO_RGB.data();
+    if (desired_clrs == ColorSpace::RGB) {
+        ConvertArray(src_sRGB, dst, [lut](unsigned char value) { return lut[value]; });
+        return dst;
+    }
+    bool to_Lab = desired_clrs == ColorSpace::Lab;
+    auto map_iter = DST_FROM_SRC.find({to_Lab ? ColorSpace::XYZ : desired_clrs, ColorSpace::RGB});
+    if (map_iter == DST_FROM_SRC.end())
+        throw std::runtime_error("There are no such transformation\n");
+    const TransferMatrix tm = map_iter->second;
+    if (to_Lab) {
+        math::WithAccuracy([&](auto accuracy) {
+            MapPixels(src_sRGB, dst,
+                      [lut, &tm, accuracy](unsigned char r, unsigned char g, unsigned char b) {
+                          auto XYZ = ApplyTransferMatrix(tm, lut[r], lut[g], lut[b]);
+                          return LabFromXYZPixel(XYZ[0], XYZ[1], XYZ[2], accuracy);
+                      });
+        });
+    } else {
+        MapPixels(src_sRGB, dst, [lut, &tm](unsigned char r, unsigned char g, unsigned char b) {
+            return ApplyTransferMatrix(tm, lut[r], lut[g], lut[b]);
+        });
+    }
+    return dst;
+}
+
+Image<unsigned char> SRGBFromImage(const Image<float>& src) {
+    Image<unsigned char> dst(ColorSpace::sRGB, src.GetWidth(), src.GetHeight(),
+                             src.GetNumOfChannels());
+    SRGBFromImage(dst, src);
+    return dst;
+}
+
+void SRGBFromImage(Image<unsigned char>& dst_sRGB, const Image<float>& src) {
+    if (dst_sRGB.GetColorSpace() != ColorSpace::sRGB)
+        throw std::runtime_error("Destination image must be in sRGB");
+    if (!AreEqualDimensions(dst_sRGB, src))
+        throw std::runtime_error("Dimensions must be equal");
+    if (src.GetNumOfChannels() != 3)
+        throw std::runtime_error("Only 3-channel images are supported");
+    const float* thresholds = GetSRGBThresholds();
+    auto encode = [thresholds](float r, float g, float b) {    // clips values as well
+        return std::array<unsigned char, 3>{linRGB_to_sRGB(r, thresholds),
+                                            linRGB_to_sRGB(g, thresholds),
+                                            linRGB_to_sRGB(b, thresholds)};
+    };
+    if (src.GetColorSpace() == ColorSpace::RGB) {
+        MapPixels(src, dst_sRGB, encode);
+        return;
+    }
+    bool from_Lab = src.GetColorSpace() == ColorSpace::Lab;
+    auto map_iter =
+        DST_FROM_SRC.find({ColorSpace::RGB, from_Lab ? ColorSpace::XYZ : src.GetColorSpace()});
+    if (map_iter == DST_FROM_SRC.end())
+        throw std::runtime_error("There are no such transformation\n");
+    const TransferMatrix tm = map_iter->second;
+    if (from_Lab) {
+        MapPixels(src, dst_sRGB, [&tm, &encode](float L, float a, float b) {
+            auto XYZ = XYZFromLabPixel(L, a, b);
+            auto RGB = ApplyTransferMatrix(tm, XYZ[0], XYZ[1], XYZ[2]);
+            return encode(RGB[0], RGB[1], RGB[2]);
+        });
+    } else {
+        MapPixels(src, dst_sRGB, [&tm, &encode](float c0, float c1, float c2) {
+            auto RGB = ApplyTransferMatrix(tm, c0, c1, c2);
+            return encode(RGB[0], RGB[1], RGB[2]);
+        });
+    }
 }
 
 }    // namespace pg
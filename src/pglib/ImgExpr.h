@@ -2,12 +2,16 @@
 
 #include <cmath>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "Pack.h"
+#include "PhotoGoodyzer/Layout.h"
+
 namespace pg {
 
 class ArrayBase;
@@ -42,6 +46,12 @@ constexpr bool has_size_and_idx = IsVectorV<T> || std::is_base_of_v<ExprBase, Re
 template <class A, class B>
 constexpr bool is_binary_op_ok = has_size_and_idx<A> || has_size_and_idx<B>;
 
+template <class T, class = void>
+struct HasFlush : std::false_type {};
+
+template <class T>
+struct HasFlush<T, std::void_t<decltype(std::declval<const T&>().Flush())>> : std::true_type {};
+
 template <class Operand>
 auto Subscript(const Operand& v, size_t i) {
     if constexpr (has_size_and_idx<Operand>) {
@@ -51,20 +61,82 @@ auto Subscript(const Operand& v, size_t i) {
     }
 }
 
+/// Returns N consecutive elements of an operand starting from i as a Pack; scalars are returned
+/// as they are and broadcast by Pack operations.
+template <std::size_t N, class Operand>
+auto SubscriptBatch(const Operand& v, size_t i) {
+    if constexpr (std::is_base_of_v<ExprBase, RemoveCVRef_t<Operand>>) {
+        return v.template Batch<N>(i);
+    } else if constexpr (std::is_base_of_v<ArrayBase, RemoveCVRef_t<Operand>>) {
+        const auto* ptr = v.begin() + i;
+        Pack<RemoveCVRef_t<decltype(*ptr)>, N> result;
+        for (std::size_t k = 0; k != N; ++k) {
+            result[k] = ptr[k];
+        }
+        return result;
+    } else if constexpr (has_size_and_idx<Operand>) {
+        Pack<RemoveCVRef_t<decltype(v[i])>, N> result;
+        for (std::size_t k = 0; k != N; ++k) {
+            result[k] = v[i + k];
+        }
+        return result;
+    } else {
+        return v;
+    }
+}
+
+/// Applies deferred transformations of an Array or of all arrays of an expression template (see
+/// Array::Flush()); does nothing for other operands.
+template <class Operand>
+void FlushOperand(const Operand& v) {
+    if constexpr (HasFlush<RemoveCVRef_t<Operand>>::value) {
+        v.Flush();
+    }
+}
+
+template <class Callable, class... Operands>
+class ImgExpr;
+
+template <class T>
+struct IsImgExpr : std::false_type {};
+
+template <class Callable, class... Operands>
+struct IsImgExpr<ImgExpr<Callable, Operands...>> : std::true_type {};
+
+/// Returns the layout of an operand, or nothing if its values do not depend on a layout (scalars,
+/// vectors, views and single-channel arrays).
+template <class Operand>
+std::optional<Layout> LayoutOf(const Operand& v) {
+    if constexpr (std::is_base_of_v<ArrayBase, RemoveCVRef_t<Operand>>) {
+        return v.GetNumOfChannels() > 1 ? std::optional<Layout>(v.GetLayout()) : std::nullopt;
+    } else if constexpr (IsImgExpr<RemoveCVRef_t<Operand>>::value) {
+        return v.GetLayout();
+    } else {
+        return std::nullopt;
+    }
+}
+
 template <class Callable, class... Operands>
 class ImgExpr : public ExprBase {
 private:
     size_t size_;
+    std::optional<Layout> layout_;
     Callable func_;
     std::tuple<const Operands&...> args_;
 
 public:
     ImgExpr() = delete;
     ImgExpr(size_t size, Callable func, const Operands&... args) :
-        size_(size), func_(func), args_(args...) {}
+        size_(size), func_(func), args_(args...) {
+        ((layout_ = layout_ ? layout_ : LayoutOf(args)), ...);
+    }
 
     size_t size() const { return size_; }
 
+    /// Returns the layout of the arrays of the expression, or nothing if it has no multi-channel
+    /// arrays
+    std::optional<Layout> GetLayout() const { return layout_; }
+
     ImgExpr(const ImgExpr& other) = default;
     ImgExpr(ImgExpr&& other) = default;
     ImgExpr& operator=(const ImgExpr& other) = default;
@@ -76,6 +148,22 @@ public:
         };
         return std::apply(call_at_index, args_);
     }
+
+    /// Applies deferred transformations of all operands; called before the expression is
+    /// evaluated, so the operands are not modified during the evaluation.
+    void Flush() const {
+        std::apply([](const Operands&... args) { (FlushOperand(args), ...); }, args_);
+    }
+
+    /// Evaluates the expression for N consecutive elements starting from idx at once.
+    /// idx + N must not exceed size().
+    template <std::size_t N>
+    auto Batch(size_t idx) const {
+        auto const call_at_batch = [this, idx](const Operands&... args) {
+            return func_(SubscriptBatch<N>(args, idx)...);
+        };
+        return std::apply(call_at_batch, args_);
+    }
 };
 
 template <class Rhs, class = std::enable_if_t<has_size_and_idx<Rhs>>>
@@ -92,7 +180,7 @@ auto operator-(const Rhs& rhs) {
 
 template <class Rhs, class = std::enable_if_t<has_size_and_idx<Rhs>>>
 auto Abs(const Rhs& rhs) {
-    auto lambda = [](const auto& r) { return std::abs(r); };
+    auto lambda = [](const auto& r) { return simd::Abs(r); };
     return ImgExpr<decltype(lambda), Rhs>{rhs.size(), lambda, rhs};
 }
 
@@ -116,13 +204,13 @@ auto Pow3(const Rhs& rhs) {
 
 template <class Rhs, class = std::enable_if_t<has_size_and_idx<Rhs>>>
 auto Sqrt(const Rhs& rhs) {
-    auto lambda = [](const auto& r) { return std::sqrt(r); };
+    auto lambda = [](const auto& r) { return simd::Sqrt(r); };
     return ImgExpr<decltype(lambda), Rhs>{rhs.size(), lambda, rhs};
 }
 
 template <class Rhs, class = std::enable_if_t<has_size_and_idx<Rhs>>>
 auto Cbrt(const Rhs& rhs) {
-    auto lambda = [](const auto& r) { return std::cbrt(r); };
+    auto lambda = [](const auto& r) { return simd::Cbrt(r); };
     return ImgExpr<decltype(lambda), Rhs>{rhs.size(), lambda, rhs};
 }
 
@@ -135,6 +223,11 @@ size_t CheckSize(const Lhs& lhs, const Rhs& rhs) {
             if (lhs.size() != rhs.size())
                 throw std::runtime_error(
                     "Sizes of left and right side in an expression must be equal");
+            std::optional<Layout> lhs_layout = LayoutOf(lhs);
+            std::optional<Layout> rhs_layout = LayoutOf(rhs);
+            if (lhs_layout && rhs_layout && *lhs_layout != *rhs_layout)
+                throw std::runtime_error(
+                    "Layouts of left and right side in an expression must be equal");
         }
     } else {
         size = rhs.size();
@@ -173,7 +266,7 @@ auto operator/(const Lhs& lhs, const Rhs& rhs) {
 template <class Lhs, class Rhs, class = std::enable_if_t<is_binary_op_ok<Lhs, Rhs>>>
 auto Pow(const Lhs& lhs, const Rhs& rhs) {
     size_t size = CheckSize(lhs, rhs);
-    auto lambda = [](const auto& l, const auto& r) { return std::pow(l, r); };
+    auto lambda = [](const auto& l, const auto& r) { return simd::Pow(l, r); };
     return ImgExpr<decltype(lambda), Lhs, Rhs>{size, lambda, lhs, rhs};
 }
 
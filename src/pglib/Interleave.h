@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "PhotoGoodyzer/Array.h"
+#include "PhotoGoodyzer/Parallel.h"
+
+namespace pg {
+
+/// Writes func(value) of the pixels [begin... end) of images of n pixels from src to dst for
+/// given layouts. Strides and offsets are compile-time constants when NumOfChannels is not 0, so
+/// the compiler may turn the loop into vector shuffles (deinterleaving loads / interleaving
+/// stores).
+template <bool SrcPlanar, bool DstPlanar, std::size_t NumOfChannels, class Src, class Dst,
+          class Func>
+void ConvertPixels(const Src* src, Dst* dst, std::size_t begin, std::size_t end, std::size_t n,
+                   std::size_t num_of_channels, Func func) {
+    const std::size_t channels = NumOfChannels ? NumOfChannels : num_of_channels;
+    const std::size_t src_stride = SrcPlanar ? 1 : channels;
+    const std::size_t dst_stride = DstPlanar ? 1 : channels;
+    const std::size_t src_plane = SrcPlanar ? n : 1;
+    const std::size_t dst_plane = DstPlanar ? n : 1;
+    for (std::size_t i = begin; i != end; ++i) {
+        for (std::size_t c = 0; c != channels; ++c) {
+            dst[c * dst_plane + i * dst_stride] = func(src[c * src_plane + i * src_stride]);
+        }
+    }
+}
+
+/// Writes func(value) of every value of src to the same pixel and channel of dst, converting
+/// the layout of src to the layout of dst (interleaving or deinterleaving channels). Arrays must
+/// have equal dimensions and must not overlap. Pixels are processed in parallel (see
+/// ParallelForItems()).
+template <class Src, class Dst, class Func>
+void ConvertArray(const Array<Src>& src, Array<Dst>& dst, Func func) {
+    if (!AreEqualDimensions(src, dst))
+        throw std::runtime_error("Dimensions must be equal");
+    const std::size_t n = src.GetImgSize();
+    const std::size_t channels = src.GetNumOfChannels();
+    const Src* src_ptr = src.begin();
+    Dst* dst_ptr = dst.begin();
+    if (src.GetLayout() == dst.GetLayout() || channels == 1) {
+        ParallelForItems<Dst>(src.size(), 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i != end; ++i) {
+                dst_ptr[i] = func(src_ptr[i]);
+            }
+        });
+        return;
+    }
+    const bool src_planar = src.GetLayout() == Layout::Planar;
+    ParallelForItems<Dst>(n, channels, [&](std::size_t begin, std::size_t end) {
+        if (!src_planar) {
+            if (channels == 3) {
+                ConvertPixels<false, true, 3>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            } else if (channels == 4) {
+                ConvertPixels<false, true, 4>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            } else {
+                ConvertPixels<false, true, 0>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            }
+        } else {
+            if (channels == 3) {
+                ConvertPixels<true, false, 3>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            } else if (channels == 4) {
+                ConvertPixels<true, false, 4>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            } else {
+                ConvertPixels<true, false, 0>(src_ptr, dst_ptr, begin, end, n, channels, func);
+            }
+        }
+    });
+}
+
+/// @see MapPixels(); a stride equals 0 if it is not known at compile time
+template <std::size_t SrcStride, std::size_t DstStride, class Src, class Dst, class Func>
+void MapPixels(const ArrayBase& src_layout, const Src* src, const ArrayBase& dst_layout, Dst* dst,
+               Func func) {
+    const std::size_t src_stride = SrcStride ? SrcStride : src_layout.GetPixelStride();
+    const std::size_t dst_stride = DstStride ? DstStride : dst_layout.GetPixelStride();
+    const Src* src0 = src + src_layout.GetChannelOffset(0);
+    const Src* src1 = src + src_layout.GetChannelOffset(1);
+    const Src* src2 = src + src_layout.GetChannelOffset(2);
+    Dst* dst0 = dst + dst_layout.GetChannelOffset(0);
+    Dst* dst1 = dst + dst_layout.GetChannelOffset(1);
+    Dst* dst2 = dst + dst_layout.GetChannelOffset(2);
+    ParallelForItems<Dst>(src_layout.GetImgSize(), 3, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i != end; ++i) {
+            auto pix = func(src0[i * src_stride], src1[i * src_stride], src2[i * src_stride]);
+            dst0[i * dst_stride] = pix[0];
+            dst1[i * dst_stride] = pix[1];
+            dst2[i * dst_stride] = pix[2];
+        }
+    });
+}
+
+/// @see MapPixels(); takes the data arrays of src_layout and dst_layout as pointers, so deferred
+/// transformations may use it on the data of an array without flushing it
+template <class Src, class Dst, class Func>
+void MapPixels(const ArrayBase& src_layout, const Src* src, const ArrayBase& dst_layout, Dst* dst,
+               Func func) {
+    if (src_layout.GetImgSize() != dst_layout.GetImgSize() ||
+        src_layout.GetNumOfChannels() < 3 || dst_layout.GetNumOfChannels() < 3)
+        throw std::runtime_error("Images must have equal sizes and at least 3 channels");
+    const std::size_t src_stride = src_layout.GetPixelStride();
+    const std::size_t dst_stride = dst_layout.GetPixelStride();
+    if (src_stride == 1 && dst_stride == 1) {
+        MapPixels<1, 1>(src_layout, src, dst_layout, dst, func);
+    } else if (src_stride == 3 && dst_stride == 3) {
+        MapPixels<3, 3>(src_layout, src, dst_layout, dst, func);
+    } else if (src_stride == 3 && dst_stride == 1) {
+        MapPixels<3, 1>(src_layout, src, dst_layout, dst, func);
+    } else if (src_stride == 1 && dst_stride == 3) {
+        MapPixels<1, 3>(src_layout, src, dst_layout, dst, func);
+    } else {
+        MapPixels<0, 0>(src_layout, src, dst_layout, dst, func);
+    }
+}
+
+/// Writes func(c0, c1, c2) of every pixel of the first three channels of src to the same pixel
+/// of dst; func returns an indexable triple. Layouts may differ; src may be dst itself if the
+/// layouts are equal. Pixel strides of 1 and 3 are compile-time constants. Pixels are processed
+/// in parallel (see ParallelForItems()), so func must be safe to call from several threads.
+template <class Src, class Dst, class Func>
+void MapPixels(const Array<Src>& src, Array<Dst>& dst, Func func) {
+    MapPixels(src, src.begin(), dst, dst.begin(), func);
+}
+
+}    // namespace pg
@@ -0,0 +1,15 @@
+#include "PhotoGoodyzer/Math.h"
+
+namespace pg::math {
+
+namespace detail {
+
+std::atomic<Accuracy> accuracy = Accuracy::Exact;
+
+}    // namespace detail
+
+void SetAccuracy(Accuracy accuracy) {
+    detail::accuracy = accuracy;
+}
+
+}    // namespace pg::math
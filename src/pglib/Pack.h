@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#include "PhotoGoodyzer/Math.h"
+
+namespace pg {
+
+/// Number of bytes evaluated at once by batched expression templates (one AVX-512 register).
+inline constexpr std::size_t PACK_BYTES = 64;
+
+/// Number of lanes of type T evaluated at once by batched expression templates
+/// (16 for float, 8 for double).
+template <class T>
+inline constexpr std::size_t PackSize = PACK_BYTES / sizeof(T) > 0 ? PACK_BYTES / sizeof(T) : 1;
+
+/// A fixed number of values processed lane by lane.
+///
+/// Every operation on a Pack is a loop with a compile-time trip count over its lanes, which
+/// compilers turn into SIMD instructions. Packs are the values produced by ImgExpr::Batch().
+template <class T, std::size_t N>
+struct Pack {
+    T lanes[N];
+
+    T& operator[](std::size_t k) { return lanes[k]; }
+    const T& operator[](std::size_t k) const { return lanes[k]; }
+};
+
+template <class T>
+struct IsPack {
+    static constexpr bool value = false;
+};
+
+template <class T, std::size_t N>
+struct IsPack<Pack<T, N>> {
+    static constexpr bool value = true;
+    static constexpr std::size_t lanes = N;
+};
+
+template <class T>
+constexpr bool IsPackV = IsPack<std::remove_cv_t<std::remove_reference_t<T>>>::value;
+
+/// Number of lanes of the first Pack among Args
+template <class First, class... Rest>
+constexpr std::size_t PackLanes() {
+    if constexpr (IsPackV<First>) {
+        return IsPack<std::remove_cv_t<std::remove_reference_t<First>>>::lanes;
+    } else {
+        return PackLanes<Rest...>();
+    }
+}
+
+/// Returns k-th lane of a Pack or the value itself for scalars
+template <class T>
+decltype(auto) Lane(const T& v, std::size_t k) {
+    if constexpr (IsPackV<T>) {
+        return v[k];
+    } else {
+        return v;
+    }
+}
+
+/// Applies func to every lane of the packs; scalar arguments are broadcast to all lanes.
+template <class Func, class... Args>
+auto LaneWise(Func func, const Args&... args) {
+    constexpr std::size_t N = PackLanes<Args...>();
+    using R = std::remove_cv_t<std::remove_reference_t<decltype(func(Lane(args, 0)...))>>;
+    Pack<R, N> result;
+    for (std::size_t k = 0; k != N; ++k) {
+        result[k] = func(Lane(args, k)...);
+    }
+    return result;
+}
+
+template <class T, std::size_t N>
+Pack<T, N> operator+(const Pack<T, N>& rhs) {
+    return rhs;
+}
+
+template <class T, std::size_t N>
+auto operator-(const Pack<T, N>& rhs) {
+    return LaneWise([](const auto& r) { return -r; }, rhs);
+}
+
+template <class Lhs, class Rhs, std::enable_if_t<IsPackV<Lhs> || IsPackV<Rhs>, int> = 0>
+auto operator+(const Lhs& lhs, const Rhs& rhs) {
+    return LaneWise([](const auto& l, const auto& r) { return l + r; }, lhs, rhs);
+}
+
+template <class Lhs, class Rhs, std::enable_if_t<IsPackV<Lhs> || IsPackV<Rhs>, int> = 0>
+auto operator-(const Lhs& lhs, const Rhs& rhs) {
+    return LaneWise([](const auto& l, const auto& r) { return l - r; }, lhs, rhs);
+}
+
+template <class Lhs, class Rhs, std::enable_if_t<IsPackV<Lhs> || IsPackV<Rhs>, int> = 0>
+auto operator*(const Lhs& lhs, const Rhs& rhs) {
+    return LaneWise([](const auto& l, const auto& r) { return l * r; }, lhs, rhs);
+}
+
+template <class Lhs, class Rhs, std::enable_if_t<IsPackV<Lhs> || IsPackV<Rhs>, int> = 0>
+auto operator/(const Lhs& lhs, const Rhs& rhs) {
+    return LaneWise([](const auto& l, const auto& r) { return l / r; }, lhs, rhs);
+}
+
+/// Mathematical functions used by expression templates. Each function accepts a scalar or a
+/// Pack, so the same expression is evaluated either per element or per batch. Cbrt() and Pow()
+/// are computed by pg::math with the accuracy read once per call, i.e. once per Pack; the lane
+/// loops of the approximations have no branches or inner loops, so they compile to vector
+/// instructions at -O2. The exact ones are vectorized only if the math library has vector
+/// versions of cbrt and pow (e.g. glibc with -ffast-math); otherwise they are called per lane.
+namespace simd {
+
+template <class T>
+auto Abs(const T& v) {
+    if constexpr (IsPackV<T>) {
+        return LaneWise([](const auto& x) { return std::abs(x); }, v);
+    } else {
+        return std::abs(v);
+    }
+}
+
+template <class T>
+auto Sqrt(const T& v) {
+    if constexpr (IsPackV<T>) {
+        return LaneWise([](const auto& x) { return std::sqrt(x); }, v);
+    } else {
+        return std::sqrt(v);
+    }
+}
+
+template <class T>
+auto Cbrt(const T& v) {
+    return math::WithAccuracy([&v](auto accuracy) {
+        auto cbrt = [accuracy](const auto& x) { return math::Cbrt(x, accuracy); };
+        if constexpr (IsPackV<T>) {
+            return LaneWise(cbrt, v);
+        } else {
+            return cbrt(v);
+        }
+    });
+}
+
+template <class Base, class Exp>
+auto Pow(const Base& base, const Exp& exp) {
+    return math::WithAccuracy([&base, &exp](auto accuracy) {
+        auto pow = [accuracy](const auto& b, const auto& e) { return math::Pow(b, e, accuracy); };
+        if constexpr (IsPackV<Base> || IsPackV<Exp>) {
+            return LaneWise(pow, base, exp);
+        } else {
+            return pow(base, exp);
+        }
+    });
+}
+
+}    // namespace simd
+
+}    // namespace pg
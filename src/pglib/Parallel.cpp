@@ -0,0 +1,269 @@
+#include "PhotoGoodyzer/Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace pg {
+
+namespace {
+
+std::mutex settings_mutex;
+ParallelSettings settings;
+
+// Built-in executor; recreated when ParallelSettings::num_threads changes
+std::shared_ptr<ThreadPool> builtin_executor;
+
+std::atomic<Executor*> default_executor = nullptr;
+
+thread_local Executor* scoped_executor = nullptr;
+
+// True for threads executing a chunk of ParallelFor()
+thread_local bool inside_parallel_for = false;
+
+std::shared_ptr<ThreadPool> GetBuiltinExecutor() {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    if (!builtin_executor) {
+        builtin_executor = std::make_shared<ThreadPool>(settings.num_threads);
+    }
+    return builtin_executor;
+}
+
+void PinCurrentThread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+    (void)cpu;
+#endif
+}
+
+}    // namespace
+
+// A block of tasks; the owner and thieves take tasks from its front
+struct alignas(64) TaskBlock {
+    std::atomic<std::size_t> next = 0;
+    std::size_t end = 0;
+};
+
+struct ThreadPool::Impl {
+    std::vector<std::thread> threads;
+    // One block per worker, the last one belongs to the calling thread
+    std::unique_ptr<TaskBlock[]> blocks;
+    std::size_t num_of_blocks = 0;
+    const std::function<void(std::size_t)>* task = nullptr;
+
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t generation = 0;
+    std::size_t active = 0;
+    bool stop = false;
+
+    // Runs the tasks of the own block, then steals the tasks of the others
+    void Work(std::size_t self) {
+        for (std::size_t k = 0; k != num_of_blocks; ++k) {
+            TaskBlock& block = blocks[(self + k) % num_of_blocks];
+            for (std::size_t i = block.next++; i < block.end; i = block.next++) {
+                (*task)(i);
+            }
+        }
+    }
+
+    void WorkerLoop(std::size_t self) {
+        std::size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+            }
+            Work(self);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0) {
+                done.notify_one();
+            }
+        }
+    }
+};
+
+ThreadPool::ThreadPool(int num_threads, std::vector<int> cpu_affinity) :
+    impl_(std::make_unique<Impl>()) {
+    if (num_threads <= 0) {
+        num_threads = int(std::thread::hardware_concurrency());
+    }
+    num_threads = std::max(num_threads, 1);
+    impl_->num_of_blocks = std::size_t(num_threads);
+    impl_->blocks = std::make_unique<TaskBlock[]>(impl_->num_of_blocks);
+    impl_->threads.reserve(num_threads - 1);
+    for (int i = 0; i != num_threads - 1; ++i) {
+        impl_->threads.emplace_back([this, i, cpu_affinity] {
+            if (!cpu_affinity.empty()) {
+                PinCurrentThread(cpu_affinity[i % cpu_affinity.size()]);
+            }
+            impl_->WorkerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->stop = true;
+    }
+    impl_->wake.notify_all();
+    for (auto& thread : impl_->threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::GetConcurrency() const {
+    return int(impl_->num_of_blocks);
+}
+
+void ThreadPool::Run(std::size_t num_of_tasks,
+                     const std::function<void(std::size_t)>& task) {
+    std::unique_lock<std::mutex> run_lock(impl_->run_mutex, std::try_to_lock);
+    if (impl_->threads.empty() || num_of_tasks == 1 || !run_lock.owns_lock()) {
+        for (std::size_t i = 0; i != num_of_tasks; ++i) {
+            task(i);
+        }
+        return;
+    }
+    const std::size_t n = impl_->num_of_blocks;
+    const std::size_t block_size = (num_of_tasks + n - 1) / n;
+    for (std::size_t k = 0; k != n; ++k) {
+        impl_->blocks[k].next = std::min(k * block_size, num_of_tasks);
+        impl_->blocks[k].end = std::min((k + 1) * block_size, num_of_tasks);
+    }
+    impl_->task = &task;
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->active = impl_->threads.size();
+        ++impl_->generation;
+    }
+    impl_->wake.notify_all();
+    impl_->Work(n - 1);
+    std::unique_lock<std::mutex> lock(impl_->mutex);
+    impl_->done.wait(lock, [this] { return impl_->active == 0; });
+}
+
+void SetParallelSettings(const ParallelSettings& new_settings) {
+    std::shared_ptr<ThreadPool> previous;
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    if (new_settings.num_threads != settings.num_threads) {
+        previous = std::move(builtin_executor);
+    }
+    settings = new_settings;
+}
+
+ParallelSettings GetParallelSettings() {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    return settings;
+}
+
+Executor* GetDefaultExecutor() {
+    if (scoped_executor) {
+        return scoped_executor;
+    }
+    Executor* executor = default_executor.load();
+    return executor ? executor : GetBuiltinExecutor().get();
+}
+
+void SetDefaultExecutor(Executor* executor) {
+    default_executor = executor;
+}
+
+ScopedExecutor::ScopedExecutor(Executor* executor) : previous_(scoped_executor) {
+    scoped_executor = executor;
+}
+
+ScopedExecutor::~ScopedExecutor() {
+    scoped_executor = previous_;
+}
+
+int GetNumThreads() {
+    return std::max(GetDefaultExecutor()->GetConcurrency(), 1);
+}
+
+void ParallelFor(std::size_t size, std::size_t chunk_size,
+                 const std::function<void(std::size_t, std::size_t)>& func) {
+    if (size == 0) {
+        return;
+    }
+    chunk_size = std::max(chunk_size, std::size_t(1));
+    std::size_t num_of_chunks = (size + chunk_size - 1) / chunk_size;
+    if (num_of_chunks == 1 || inside_parallel_for) {
+        func(0, size);
+        return;
+    }
+    // Keeps the built-in executor alive if the settings are changed meanwhile
+    std::shared_ptr<ThreadPool> builtin;
+    Executor* executor = scoped_executor ? scoped_executor : default_executor.load();
+    if (!executor) {
+        builtin = GetBuiltinExecutor();
+        executor = builtin.get();
+    }
+    if (executor->GetConcurrency() <= 1) {
+        func(0, size);
+        return;
+    }
+    std::atomic<bool> failed = false;
+    std::exception_ptr exception = nullptr;
+    std::mutex exception_mutex;
+    executor->Run(num_of_chunks, [&](std::size_t chunk) {
+        if (failed) {
+            return;
+        }
+        const bool was_inside = inside_parallel_for;
+        inside_parallel_for = true;
+        try {
+            std::size_t begin = chunk * chunk_size;
+            func(begin, std::min(begin + chunk_size, size));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(exception_mutex);
+            if (!exception) {
+                exception = std::current_exception();
+            }
+            failed = true;
+        }
+        inside_parallel_for = was_inside;
+    });
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+void ParallelForTiles(int width, int height, int tile_width, int tile_height,
+                      const std::function<void(int, int, int, int)>& func) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    tile_width = std::clamp(tile_width, 1, width);
+    tile_height = std::clamp(tile_height, 1, height);
+    const std::size_t cols = (width + tile_width - 1) / tile_width;
+    const std::size_t rows = (height + tile_height - 1) / tile_height;
+    ParallelFor(cols * rows, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t tile = begin; tile != end; ++tile) {
+            int x = int(tile % cols) * tile_width;
+            int y = int(tile / cols) * tile_height;
+            func(x, y, std::min(tile_width, width - x), std::min(tile_height, height - y));
+        }
+    });
+}
+
+}    // namespace pg
@@ -77,4 +77,21 @@ std::map<std::pair<ColorSpace, ColorSpace>, TransferMatrix> DST_FROM_SRC = {
 
 };
 
+TransferMatrix operator*(const TransferMatrix& lhs, const TransferMatrix& rhs) {
+    const float* lhs_rows[3] = {lhs.row1, lhs.row2, lhs.row3};
+    const float* rhs_rows[3] = {rhs.row1, rhs.row2, rhs.row3};
+    TransferMatrix result;
+    float* result_rows[3] = {result.row1, result.row2, result.row3};
+    for (int i = 0; i != 3; ++i) {
+        for (int j = 0; j != 3; ++j) {
+            double sum = 0.0;
+            for (int k = 0; k != 3; ++k) {
+                sum += double(lhs_rows[i][k]) * rhs_rows[k][j];
+            }
+            result_rows[i][j] = float(sum);
+        }
+    }
+    return result;
+}
+
 } // namespace pg
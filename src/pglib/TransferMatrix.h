@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <utility>
 
@@ -13,6 +14,17 @@ struct TransferMatrix {
     float row3[3] = {};
 };
 
+/// Multiplies a pixel by the matrix
+template <typename T>
+inline std::array<T, 3> ApplyTransferMatrix(const TransferMatrix& tm, T c0, T c1, T c2) {
+    return {tm.row1[0] * c0 + tm.row1[1] * c1 + tm.row1[2] * c2,
+            tm.row2[0] * c0 + tm.row2[1] * c1 + tm.row2[2] * c2,
+            tm.row3[0] * c0 + tm.row3[1] * c1 + tm.row3[2] * c2};
+}
+
+/// Returns the matrix of the transformation rhs followed by lhs (the matrix product lhs * rhs)
+TransferMatrix operator*(const TransferMatrix& lhs, const TransferMatrix& rhs);
+
 // An array of color transfer matrices. See in TransferMatrix.cpp
 extern std::map<std::pair<ColorSpace, ColorSpace>, TransferMatrix> DST_FROM_SRC;
 
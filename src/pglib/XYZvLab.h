@@ -1,14 +1,17 @@
 #pragma once
 
+#include <array>
 #include <cmath>
 
+#include "PhotoGoodyzer/Math.h"
+
 namespace pg {
 
 // From http://www.easyrgb.com/en/math.php
 template <typename T>
-inline T Labf_function(T value) {
+inline T Labf_function(T value, math::Accuracy accuracy) {
     if (value > 0.008856f) {
-        return std::cbrt(value);
+        return math::Cbrt(value, accuracy);
     } else {
         return (7.787f * value) + (16.0f / 116.0f);
     }
@@ -24,6 +27,29 @@ inline T LabReversedf_function(T value) {
     }
 }
 
+/// Converts a CIEXYZ pixel to CIELab (Standart Illuminant D65); pass the accuracy of
+/// math::WithAccuracy() in loops
+template <typename T>
+inline std::array<T, 3> LabFromXYZPixel(T X, T Y, T Z, math::Accuracy accuracy) {
+    T x = Labf_function(X / 0.950489f, accuracy);    // for Standart Illuminnat D65
+    T y = Labf_function(Y, accuracy);
+    T z = Labf_function(Z / 1.088840f, accuracy);
+    return {116.0f * y - 16.0f,    // L
+            500.0f * (x - y),      // a
+            200.0f * (y - z)};     // b
+}
+
+/// Converts a CIELab pixel to CIEXYZ (Standart Illuminant D65)
+template <typename T>
+inline std::array<T, 3> XYZFromLabPixel(T L, T a, T b) {
+    T var_Y = (L + 16.0f) / 116.0f;
+    T var_X = a / 500.0f + var_Y;
+    T var_Z = var_Y - b / 200.0f;
+    return {LabReversedf_function(var_X) * 0.950489f,    // X
+            LabReversedf_function(var_Y),                // Y
+            LabReversedf_function(var_Z) * 1.088840f};   // Z
+}
+
 /*   // From https://en.wikipedia.org/wiki/CIELAB_color_space
   static float LAB_SIGMA = 6.0f/29.0f;
   static float LAB_SIGMA_SQUARED = std::pow(6.0f/29.0f, 2.0f);
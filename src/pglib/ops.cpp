@@ -1,13 +1,25 @@
 #include "PhotoGoodyzer/ops.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <complex>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 
+#include "PhotoGoodyzer/Math.h"
+#include "PhotoGoodyzer/QuantileSketch.h"
 #include "Equalizer.h"
 #include "FFT.h"
 #include "ImgExpr.h"
+#include "PowTable.h"
+#include "TransferMatrix.h"
 
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include <stb_image_resize.h>
@@ -15,86 +27,287 @@
 namespace pg::ops {
 
 Array<float> Resize(const Array<float>& other, int new_width, int new_height) {
-    Array<float> dst(new_width, new_height, other.GetNumOfChannels());
+    Array<float> dst(other.GetLayout(), new_width, new_height, other.GetNumOfChannels());
+    if (other.GetLayout() == Layout::Planar) {
+        for (int channel = 0; channel != other.GetNumOfChannels(); ++channel) {
+            stbir_resize_float(other.begin() + other.GetChannelOffset(channel), other.GetWidth(),
+                               other.GetHeight(), 0, dst.begin() + dst.GetChannelOffset(channel),
+                               new_width, new_height, 0, 1);
+        }
+        return dst;
+    }
     stbir_resize_float(other.begin(), other.GetWidth(), other.GetHeight(), 0, dst.begin(),
                        new_width, new_height, 0, dst.GetNumOfChannels());
     return dst;
 }
 
+namespace {
+
+// Source samples and the weight of the second one for linear interpolation of a line of src_size
+// samples at dst_size points; sample centres of both lines are aligned as in Resize()
+struct LinearTap {
+    int first;
+    int second;
+    float weight;
+};
+
+std::vector<LinearTap> GetLinearTaps(int src_size, int dst_size) {
+    std::vector<LinearTap> taps(dst_size);
+    const double scale = double(src_size) / dst_size;
+    for (int i = 0; i != dst_size; ++i) {
+        double pos = std::clamp((i + 0.5) * scale - 0.5, 0.0, double(src_size - 1));
+        int first = int(pos);
+        taps[i] = {first, std::min(first + 1, src_size - 1), float(pos - first)};
+    }
+    return taps;
+}
+
+float Lerp(const float* line, const LinearTap& tap) {
+    return line[tap.first] + tap.weight * (line[tap.second] - line[tap.first]);
+}
+
+// Adaptation and reference white matrices of CAMCompress() sampled at the pixels of an image of
+// width x height; matrices of the size of the image are sampled exactly (all weights are zero)
+class AdaptationMap {
+private:
+    const float* adapt_ptr_;
+    const float* white_ptr_;
+    int map_width_;
+    std::vector<LinearTap> x_taps_;
+    std::vector<LinearTap> y_taps_;
+
+public:
+    AdaptationMap(const Channel<float>& adapt_matrix, const Channel<float>& ref_white, int width,
+                  int height) :
+        adapt_ptr_(adapt_matrix.begin()),
+        white_ptr_(ref_white.begin()),
+        map_width_(adapt_matrix.GetWidth()),
+        x_taps_(GetLinearTaps(adapt_matrix.GetWidth(), width)),
+        y_taps_(GetLinearTaps(adapt_matrix.GetHeight(), height)) {
+        if (std::make_pair(adapt_matrix.GetWidth(), adapt_matrix.GetHeight()) !=
+            std::make_pair(ref_white.GetWidth(), ref_white.GetHeight())) {
+            throw std::runtime_error("Widths and heights of matrices must be equal");
+        } else if (adapt_matrix.GetWidth() <= 0 || adapt_matrix.GetHeight() <= 0) {
+            throw std::runtime_error("Matrices must not be empty");
+        }
+    }
+
+    // Writes adapt_matrix / ref_white at the y-th row of the image to fl_div_w; columns of the
+    // matrices are interpolated once per row to the scratch vector of 2 * map width values
+    void GetRow(size_t y, std::vector<float>& scratch, float* fl_div_w) const {
+        scratch.resize(2 * size_t(map_width_));
+        float* adapt_row = scratch.data();
+        float* white_row = adapt_row + map_width_;
+        const LinearTap& y_tap = y_taps_[y];
+        const LinearTap column_tap{0, (y_tap.second - y_tap.first) * map_width_, y_tap.weight};
+        const size_t row_begin = size_t(y_tap.first) * map_width_;
+        for (int x = 0; x != map_width_; ++x) {
+            adapt_row[x] = Lerp(adapt_ptr_ + row_begin + x, column_tap);
+            white_row[x] = Lerp(white_ptr_ + row_begin + x, column_tap);
+        }
+        for (size_t x = 0; x != x_taps_.size(); ++x) {
+            fl_div_w[x] = Lerp(adapt_row, x_taps_[x]) / Lerp(white_row, x_taps_[x]);
+        }
+    }
+};
+
+// Luminance level adaptation factor FL of iCAM06 for the luminance of the reference white (the
+// reduced formulas of GetAdaptMatrix())
+inline float GetAdaptFactor(float white, math::Accuracy accuracy) {
+    float k = 1.0f / (white + 1.0f);
+    float k_in4 = k * k * k * k;
+    return 0.2f * k_in4 * white +
+           0.1f * (1.0f - k_in4) * (1.0f - k_in4) * math::Cbrt(white, accuracy);
+}
+
+std::atomic<CurveEvaluation> default_curve_evaluation = CurveEvaluation::Exact;
+
+// Calls func(power) with a function object returning x^exponent for x >= 0 computed as selected
+// by evaluation (math::Pow() with the library accuracy for Exact), so loops over values are
+// compiled for every kind of evaluation
+template <class Func>
+void WithPower(float exponent, CurveEvaluation evaluation, Func func) {
+    if (evaluation == CurveEvaluation::Default) {
+        evaluation = GetCurveEvaluation();
+    }
+    if (evaluation == CurveEvaluation::Tabulated) {
+        func(PowTable(exponent));
+    } else {
+        math::WithAccuracy([&](auto accuracy) {
+            func([exponent, accuracy](float x) { return math::Pow(x, exponent, accuracy); });
+        });
+    }
+}
+
+// Compression curve of CAMCompress() for the adapted cone response value; power(x) returns x^gamma.
+// The sign is applied without branches, so loops over pixels can be vectorized
+template <class Power>
+inline float CompressResponse(float value, const Power& power) {
+    float new_val = power(std::abs(value));
+    return std::copysign(400.0f, value) * new_val / (new_val + 27.13f) + 0.1f;
+}
+
+}    // namespace
+
+void SetCurveEvaluation(CurveEvaluation evaluation) {
+    if (evaluation == CurveEvaluation::Default) {
+        throw std::runtime_error("The default evaluation must be Exact or Tabulated");
+    }
+    default_curve_evaluation = evaluation;
+}
+
+CurveEvaluation GetCurveEvaluation() {
+    return default_curve_evaluation;
+}
+
 Image<float> CAMCompress(const Image<float>& src, const Channel<float>& adapt_matrix,
-                         const Channel<float>& ref_white, float gamma) {
+                         const Channel<float>& ref_white, float gamma,
+                         CurveEvaluation evaluation) {
     if (src.GetColorSpace() != ColorSpace::LMS) {
         throw std::runtime_error("Only for LMS images");
-    } else if (std::make_pair(src.GetWidth(), src.GetHeight()) !=
-                   std::make_pair(adapt_matrix.GetWidth(), adapt_matrix.GetHeight()) ||
-               std::make_pair(src.GetWidth(), src.GetHeight()) !=
-                   std::make_pair(ref_white.GetWidth(), ref_white.GetHeight())) {
-        throw std::runtime_error("Widths and heights of image and matrices must be equal");
-    }
-    Image<float> dst(src.GetColorSpace(), src.GetWidth(), src.GetHeight(), src.GetNumOfChannels());
-    auto src_iter = src.begin();
-    auto white_iter = ref_white.begin();
-    auto dst_iter = dst.begin();
-    for (auto adapt_iter = adapt_matrix.begin(); adapt_iter != adapt_matrix.end();) {
-        float fl_div_w = *adapt_iter / *white_iter;
-        for (int _ = 0; _ != 3; ++_) {
-            if (*src_iter < 0.0f) {
-                float new_val = std::pow(-fl_div_w * *src_iter, gamma);
-                *dst_iter = new_val / (new_val + 27.13f) * (-400.0f) + 0.1f;
-            } else {
-                float new_val = std::pow(fl_div_w * *src_iter, gamma);
-                *dst_iter = new_val / (new_val + 27.13f) * 400.0f + 0.1f;
-            }
-            dst_iter++;
-            src_iter++;
-        }
-        adapt_iter++;
-        white_iter++;
     }
+    const int width = src.GetWidth();
+    const AdaptationMap map(adapt_matrix, ref_white, width, src.GetHeight());
+    Image<float> dst(src.GetColorSpace(), src.GetLayout(), src.GetWidth(), src.GetHeight(),
+                     src.GetNumOfChannels());
+    const size_t stride = src.GetPixelStride();
+    const float* src_ptrs[3];
+    float* dst_ptrs[3];
+    for (int channel = 0; channel != 3; ++channel) {
+        src_ptrs[channel] = src.begin() + src.GetChannelOffset(channel);
+        dst_ptrs[channel] = dst.begin() + dst.GetChannelOffset(channel);
+    }
+    WithPower(gamma, evaluation, [&](const auto& power) {
+        ParallelForItems<float>(src.GetHeight(), size_t(width) * 3, [&](size_t begin, size_t end) {
+            std::vector<float> scratch;
+            std::vector<float> fl_div_w(width);
+            std::vector<float> row(width);
+            for (size_t y = begin; y != end; ++y) {
+                map.GetRow(y, scratch, fl_div_w.data());
+                const size_t row_offset = y * width * stride;
+                for (int channel = 0; channel != 3; ++channel) {
+                    const float* src_ptr = src_ptrs[channel] + row_offset;
+                    float* dst_ptr = dst_ptrs[channel] + row_offset;
+                    for (int x = 0; x != width; ++x) {
+                        row[x] = fl_div_w[x] * src_ptr[x * stride];
+                    }
+                    // Contiguous values, so the curve is vectorized
+                    for (float& value : row) {
+                        value = CompressResponse(value, power);
+                    }
+                    for (int x = 0; x != width; ++x) {
+                        dst_ptr[x * stride] = row[x];
+                    }
+                }
+            }
+        });
+    });
     return dst;
 }
 
-Image<float> CAMDecompress(const Image<float>& LMS, float gamma) {
+Image<float> CAMDecompress(const Image<float>& LMS, float gamma, CurveEvaluation evaluation) {
     if (LMS.GetColorSpace() != ColorSpace::LMS) {
         throw std::runtime_error("For LMS images only");
     } else {
-        Image<float> dst(LMS.GetColorSpace(), LMS.GetWidth(), LMS.GetHeight(),
+        Image<float> dst(LMS.GetColorSpace(), LMS.GetLayout(), LMS.GetWidth(), LMS.GetHeight(),
                          LMS.GetNumOfChannels());
-        auto src_iter = LMS.begin();
-        for (auto dst_iter = dst.begin(); dst_iter != dst.end(); ++dst_iter) {
-            float val = *src_iter++ - 0.1f;
-            float sign = float(0.0f < val) - (val < 0.0f);
-            val = std::abs(val);
-            // also * 100/FL in original CAM16
-            *dst_iter = sign * std::pow(27.13f * val / (400.0f - val), 1.0f / gamma);
-        }
+        const float* src_ptr = LMS.begin();
+        float* dst_ptr = dst.begin();
+        WithPower(1.0f / gamma, evaluation, [&](const auto& power) {
+            ParallelForItems<float>(dst.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i != end; ++i) {
+                    float val = src_ptr[i] - 0.1f;
+                    float sign = float(0.0f < val) - (val < 0.0f);
+                    val = std::abs(val);
+                    // also * 100/FL in original CAM16
+                    dst_ptr[i] = sign * power(27.13f * val / (400.0f - val));
+                }
+            });
+        });
         return dst;
     }
 }
 
-Image<float> LocLightAdapt(const Image<float>& XYZ) {
+Image<float> LocLightAdapt(const Image<float>& XYZ, AdaptationQuality quality) {
     if (XYZ.GetColorSpace() != ColorSpace::XYZ) {
         throw std::runtime_error("Only for XYZ images");
     }
     float max_L = 16250.0f;    // maximum luminance(cd/m2): max_L = 20,000;
+    const float scale = max_L / Max(ChannelView(XYZ, 1))[0];    // Y to normalized luminance
     Channel<float> white = CopyChannel(XYZ, 1);
-    int src_w = white.GetWidth();
-    int src_h = white.GetHeight();
-    auto maxY = MinMaxValues(white)[1];
-    white *= (max_L / maxY);    // Y to normalized luminance
-    white = Downscale(white);
-    white = ApplyGaussianBlur(white);
-    white = Resize(white, src_w, src_h);
+    if (quality != AdaptationQuality::Full) {
+        // The map stays at the low resolution, it is interpolated row by row below
+        white = Downscale(white, quality == AdaptationQuality::Preview ? 128 : 1024);
+    }
+    white *= scale;
+    // The overlap-save blur keeps the memory of higher resolution maps bounded
+    white = quality == AdaptationQuality::Preview ? ApplyGaussianBlur(white)
+                                                  : ApplyGaussianBlurTiled(white);
     // Cone response / Tone compression and Local lightness adaptation due to iCam06
     Channel<float> FL = GetAdaptMatrix(white);
-    Image<float> result(XYZ.GetColorSpace(), XYZ.GetWidth(), XYZ.GetHeight(),
+    const int width = XYZ.GetWidth();
+    const AdaptationMap map(FL, white, width, XYZ.GetHeight());
+    // The scaling is folded into the matrix, so pixels are read, converted to LMS, compressed as
+    // by CAMCompress() and converted back to XYZ in a single pass over rows
+    TransferMatrix lms_from_xyz = DST_FROM_SRC.at({ColorSpace::LMS, ColorSpace::XYZ});
+    for (float* row : {lms_from_xyz.row1, lms_from_xyz.row2, lms_from_xyz.row3}) {
+        std::transform(row, row + 3, row, [scale](float value) { return value * scale; });
+    }
+    const TransferMatrix xyz_from_lms = DST_FROM_SRC.at({ColorSpace::XYZ, ColorSpace::LMS});
+    const float gamma = 0.7f;    // gamma in Icam06 = 0.7 (0.6<p<0.85); indoor scene prefer low p
+                                 // values, in CAM16 = 0.42
+    Image<float> result(XYZ.GetColorSpace(), XYZ.GetLayout(), XYZ.GetWidth(), XYZ.GetHeight(),
                         XYZ.GetNumOfChannels());
-    result = XYZ * (max_L / maxY);
-    result.ChangeColorSpace(ColorSpace::LMS);
-    result = CAMCompress(result, FL, white, 0.7f);    // gamma in Icam06 = 0.7 (0.6<p<0.85); indoor
-                                                      // scene prefer low p values, in CAM16 = 0.42
-    // There are other functions in iCam06 here, but it seems that their influence is negligible
-    result.ChangeColorSpace(ColorSpace::XYZ);
+    const size_t stride = XYZ.GetPixelStride();
+    const float* src_ptrs[3];
+    float* dst_ptrs[3];
+    for (int channel = 0; channel != 3; ++channel) {
+        src_ptrs[channel] = XYZ.begin() + XYZ.GetChannelOffset(channel);
+        dst_ptrs[channel] = result.begin() + result.GetChannelOffset(channel);
+    }
+    WithPower(gamma, CurveEvaluation::Default, [&](const auto& power) {
+        ParallelForItems<float>(XYZ.GetHeight(), size_t(width) * 3, [&](size_t begin, size_t end) {
+            std::vector<float> scratch;
+            std::vector<float> fl_div_w(width);
+            // L, M and S values of a row one after another; the row stays in the cache between the
+            // loops below, and the curve is vectorized over contiguous values
+            std::vector<float> lms(size_t(width) * 3);
+            float* L_ptr = lms.data();
+            float* M_ptr = L_ptr + width;
+            float* S_ptr = M_ptr + width;
+            for (size_t y = begin; y != end; ++y) {
+                map.GetRow(y, scratch, fl_div_w.data());
+                const size_t offset = y * width * stride;
+                const float* X_ptr = src_ptrs[0] + offset;
+                const float* Y_ptr = src_ptrs[1] + offset;
+                const float* Z_ptr = src_ptrs[2] + offset;
+                for (int x = 0; x != width; ++x) {
+                    const size_t i = x * stride;
+                    auto [L, M, S] =
+                        ApplyTransferMatrix(lms_from_xyz, X_ptr[i], Y_ptr[i], Z_ptr[i]);
+                    L_ptr[x] = fl_div_w[x] * L;
+                    M_ptr[x] = fl_div_w[x] * M;
+                    S_ptr[x] = fl_div_w[x] * S;
+                }
+                for (float& value : lms) {
+                    value = CompressResponse(value, power);
+                }
+                // There are other functions in iCam06 here, but it seems that their influence is
+                // negligible
+                float* dst_X_ptr = dst_ptrs[0] + offset;
+                float* dst_Y_ptr = dst_ptrs[1] + offset;
+                float* dst_Z_ptr = dst_ptrs[2] + offset;
+                for (int x = 0; x != width; ++x) {
+                    const size_t i = x * stride;
+                    auto [X, Y, Z] =
+                        ApplyTransferMatrix(xyz_from_lms, L_ptr[x], M_ptr[x], S_ptr[x]);
+                    dst_X_ptr[i] = X;
+                    dst_Y_ptr[i] = Y;
+                    dst_Z_ptr[i] = Z;
+                }
+            }
+        });
+    });
     return result;
 }
 
@@ -102,26 +315,12 @@ Image<float> CorrectColorTemperature(const Image<float>& img_lab_src) {
     if (img_lab_src.GetColorSpace() != ColorSpace::Lab) {
         throw std::runtime_error("Only for Lab images");
     } else {
-        float mean_a = 0.0f;
-        float mean_b = 0.0f;
-        auto src_ptr = img_lab_src.begin();
-        for (int _ = 0; _ != img_lab_src.GetImgSize(); ++_) {
-            float L = *src_ptr++ / 100.0f;
-            mean_a += (*src_ptr++ * L);
-            mean_b += (*src_ptr++ * L);
-        }
-        mean_a /= img_lab_src.GetImgSize();
-        mean_b /= img_lab_src.GetImgSize();
-        Image<float> result(ColorSpace::Lab, img_lab_src.GetWidth(), img_lab_src.GetHeight(),
-                            img_lab_src.GetNumOfChannels());
-        src_ptr = img_lab_src.begin();
-        auto result_ptr = result.begin();
-        for (int _ = 0; _ != img_lab_src.GetImgSize(); ++_) {
-            float L = *src_ptr++;
-            *result_ptr++ = L;
-            *result_ptr++ = (*src_ptr++ - mean_a * L / 100.0f);    // a
-            *result_ptr++ = (*src_ptr++ - mean_b * L / 100.0f);    // b
-        }
+        auto L = ChannelView(img_lab_src, 0);
+        float mean_a = float(Mean(ChannelView(img_lab_src, 1) * L)[0] / 100.0);
+        float mean_b = float(Mean(ChannelView(img_lab_src, 2) * L)[0] / 100.0);
+        Image<float> result(img_lab_src);
+        ChannelView(result, 1) = ChannelView(img_lab_src, 1) - L * (mean_a / 100.0f);    // a
+        ChannelView(result, 2) = ChannelView(img_lab_src, 2) - L * (mean_b / 100.0f);    // b
         return result;
     }
 }
@@ -139,16 +338,33 @@ Channel<float> MakeDistMap(const Channel<float>& other) {
     return result;
 }
 
-Channel<float> ApplyGaussianBlur(const Channel<float>& src, int scale_parameter) {
-    int width_field = src.GetWidth() / 2;
-    int height_field = src.GetHeight() / 2;
-    int max_dim = std::max(src.GetWidth(), src.GetHeight());
-    Channel<float> white = PadReflect(src, width_field, height_field);
-    Channel<float> kernel = MakeDistMap(white);
+namespace {
+
+// Frequency responses of the Gaussian filters of ApplyGaussianBlur() keyed by (padded width,
+// padded height, larger dimension of the channel, scale parameter, accuracy of the kernel); a few
+// recent ones are kept
+using ResponseKey = std::tuple<int, int, int, int, math::Accuracy>;
+std::mutex responses_mutex;
+std::map<ResponseKey, std::shared_ptr<const std::vector<float>>> responses;
+std::deque<ResponseKey> responses_order;
+constexpr size_t MAX_CACHED_RESPONSES = 16;
+
+std::shared_ptr<const std::vector<float>> GetGaussianResponse(int width, int height,
+                                                              int max_dim, int scale_parameter) {
+    const math::Accuracy accuracy = math::GetAccuracy();
+    const ResponseKey key(width, height, max_dim, scale_parameter, accuracy);
+    {
+        std::lock_guard<std::mutex> lock(responses_mutex);
+        auto iter = responses.find(key);
+        if (iter != responses.end()) {
+            return iter->second;
+        }
+    }
+    Channel<float> kernel = MakeDistMap(Channel<float>(width, height));
     auto kernel_iter = kernel.begin();
     for (int _ = 0; _ != kernel.GetImgSize(); ++_) {
         auto value = *kernel_iter * scale_parameter / max_dim;
-        *kernel_iter = std::exp(-value * value);
+        *kernel_iter = math::Exp(-value * value, accuracy);
         kernel_iter++;
     }
     FFTr2c filter(kernel.begin(), kernel.GetWidth(), kernel.GetHeight());
@@ -156,11 +372,283 @@ Channel<float> ApplyGaussianBlur(const Channel<float>& src, int scale_parameter)
     filter.ReduceImagine();
     filter.ClipNegativeOutRealToZero();
     filter.RemoveOutZeroFreq();
+    auto response = std::make_shared<const std::vector<float>>(filter.GetOutReal());
+    std::lock_guard<std::mutex> lock(responses_mutex);
+    if (responses.emplace(key, response).second) {
+        responses_order.push_back(key);
+        if (responses_order.size() > MAX_CACHED_RESPONSES) {
+            responses.erase(responses_order.front());
+            responses_order.pop_front();
+        }
+    }
+    return response;
+}
+
+// Returns the standard deviation in pixels of the kernel of ApplyGaussianBlur()
+double GetGaussianSigma(const Channel<float>& src, int scale_parameter) {
+    return std::max(src.GetWidth(), src.GetHeight()) / (scale_parameter * std::sqrt(2.0));
+}
+
+// Reflected fields of the FFT blur: half of the channel on every side, the right and the bottom
+// ones extended so that the padded sizes have no prime factors but 2, 3, 5 and 7
+struct BlurPadding {
+    int left;
+    int top;
+    int right;
+    int bottom;
+
+    BlurPadding(int width, int height) : left(width / 2), top(height / 2) {
+        right = GetFastFFTSize(width + 2 * left) - width - left;
+        bottom = GetFastFFTSize(height + 2 * top) - height - top;
+    }
+};
+
+Channel<float> ApplyGaussianBlurFFT(const Channel<float>& src, int scale_parameter) {
+    const BlurPadding padding(src.GetWidth(), src.GetHeight());
+    int max_dim = std::max(src.GetWidth(), src.GetHeight());
+    Channel<float> white =
+        PadReflect(src, padding.left, padding.top, padding.right, padding.bottom);
+    auto response =
+        GetGaussianResponse(white.GetWidth(), white.GetHeight(), max_dim, scale_parameter);
     FFTr2c FFT_src(white.begin(), white.GetWidth(), white.GetHeight());
     FFT_src.ForwardTransform();
-    FFT_src.MultiplyOutByRealOut(filter);    // apply filter
+    FFT_src.MultiplyOutByReal(*response);    // apply filter
+    FFT_src.InverseTransform();
+    return Crop(white, padding.left, padding.top, src.GetWidth(), src.GetHeight());
+}
+
+// Third-order recursive approximation of the Gaussian by van Vliet, Young and Verbeek (1998):
+// the poles optimized for the standard deviation 2 are raised to the power 1/q, where q gives the
+// filter the desired variance
+struct RecursiveGaussian {
+    double B;
+    double b1;
+    double b2;
+    double b3;
+    // Number of values a line is extended by at both ends
+    int extension;
+
+    explicit RecursiveGaussian(double sigma) {
+        using Complex = std::complex<double>;
+        const Complex poles[3] = {{1.4165, 1.00829}, {1.4165, -1.00829}, {1.86543, 0.0}};
+        // A causal and an anticausal pole d add the variance 2 * d / (d - 1)^2, which grows with q
+        auto variance = [&poles](double q) {
+            Complex sum = 0.0;
+            for (const Complex& pole : poles) {
+                Complex d = std::pow(pole, 1.0 / q);
+                sum += 2.0 * d / ((d - 1.0) * (d - 1.0));
+            }
+            return sum.real();
+        };
+        double q_min = 0.0;
+        double q_max = sigma;
+        while (variance(q_max) < sigma * sigma) {
+            q_max *= 2.0;
+        }
+        for (int _ = 0; _ != 64; ++_) {
+            double q = 0.5 * (q_min + q_max);
+            (variance(q) < sigma * sigma ? q_min : q_max) = q;
+        }
+        // 1 - b1 z^-1 - b2 z^-2 - b3 z^-3 is the product of (1 - z^-1 / d) over the poles
+        Complex r[3];
+        for (int k = 0; k != 3; ++k) {
+            r[k] = 1.0 / std::pow(poles[k], 2.0 / (q_min + q_max));
+        }
+        b1 = (r[0] + r[1] + r[2]).real();
+        b2 = -(r[0] * r[1] + r[0] * r[2] + r[1] * r[2]).real();
+        b3 = (r[0] * r[1] * r[2]).real();
+        B = 1.0 - (b1 + b2 + b3);
+        extension = int(std::ceil(4.0 * sigma)) + 3;
+    }
+
+    // Filters `count` interleaved lines of n values: the i-th value of the j-th line is
+    // data[i * step + j * line_step]. buffer is a scratch of (n + 2 * extension + 6) * count values
+    void Filter(float* data, int n, int count, size_t step, size_t line_step,
+                std::vector<double>& buffer) const {
+        const int length = n + 2 * extension;
+        buffer.resize(size_t(length + 6) * count);
+        double* values = buffer.data() + 3 * count;
+        // Extension by half-sample reflection, as in the symmetric extension of DCT-II
+        for (int k = 0; k != length; ++k) {
+            int i = k - extension;
+            while (i < 0 || i >= n) {
+                i = i < 0 ? -i - 1 : 2 * n - 1 - i;
+            }
+            for (int j = 0; j != count; ++j) {
+                values[k * count + j] = data[i * step + j * line_step];
+            }
+        }
+        // The filter has the unit gain, so the states before the first (after the last) value
+        // start as a constant signal equal to it
+        for (int k = -3; k != 0; ++k) {
+            std::copy(values, values + count, values + k * count);
+        }
+        for (int k = 0; k != length; ++k) {
+            double* value = values + k * count;
+            for (int j = 0; j != count; ++j) {
+                value[j] = B * value[j] + b1 * value[j - count] + b2 * value[j - 2 * count] +
+                           b3 * value[j - 3 * count];
+            }
+        }
+        for (int k = length; k != length + 3; ++k) {
+            std::copy(values + (length - 1) * count, values + length * count, values + k * count);
+        }
+        for (int k = length - 1; k >= 0; --k) {
+            double* value = values + k * count;
+            for (int j = 0; j != count; ++j) {
+                value[j] = B * value[j] + b1 * value[j + count] + b2 * value[j + 2 * count] +
+                           b3 * value[j + 3 * count];
+            }
+        }
+        for (int i = 0; i != n; ++i) {
+            for (int j = 0; j != count; ++j) {
+                data[i * step + j * line_step] = float(values[(i + extension) * count + j]);
+            }
+        }
+    }
+};
+
+}    // namespace
+
+Channel<float> ApplyGaussianBlur(const Channel<float>& src, int scale_parameter,
+                                 BlurBackend backend) {
+    if (backend == BlurBackend::Auto) {
+        double sigma = GetGaussianSigma(src, scale_parameter);
+        int min_dim = std::min(src.GetWidth(), src.GetHeight());
+        backend = sigma >= 1.0 && 6.0 * sigma <= min_dim ? BlurBackend::Recursive
+                                                          : BlurBackend::DCT;
+    }
+    switch (backend) {
+        case BlurBackend::FFT:
+            return ApplyGaussianBlurFFT(src, scale_parameter);
+        case BlurBackend::Recursive:
+            return ApplyGaussianBlurRecursive(src, scale_parameter);
+        case BlurBackend::Tiled:
+            return ApplyGaussianBlurTiled(src, scale_parameter);
+        default:
+            return ApplyGaussianBlurDCT(src, scale_parameter);
+    }
+}
+
+Image<float> ApplyGaussianBlur(const Image<float>& src, int scale_parameter,
+                               BlurBackend backend) {
+    Image<float> result(src.GetColorSpace(), src.GetLayout(), src.GetWidth(), src.GetHeight(),
+                        src.GetNumOfChannels());
+    if (backend != BlurBackend::FFT) {
+        for (int channel = 0; channel != src.GetNumOfChannels(); ++channel) {
+            Channel<float> blurred =
+                ApplyGaussianBlur(CopyChannel(src, channel), scale_parameter, backend);
+            LoadFromChannel(result, blurred, channel);
+        }
+        return result;
+    }
+    const BlurPadding padding(src.GetWidth(), src.GetHeight());
+    const int max_dim = std::max(src.GetWidth(), src.GetHeight());
+    const int padded_width = src.GetWidth() + padding.left + padding.right;
+    const int padded_height = src.GetHeight() + padding.top + padding.bottom;
+    Array<float> planes(Layout::Planar, padded_width, padded_height, src.GetNumOfChannels());
+    for (int channel = 0; channel != src.GetNumOfChannels(); ++channel) {
+        Channel<float> padded = PadReflect(CopyChannel(src, channel), padding.left, padding.top,
+                                           padding.right, padding.bottom);
+        std::copy(padded.begin(), padded.end(), planes.begin() + planes.GetChannelOffset(channel));
+    }
+    auto response = GetGaussianResponse(padded_width, padded_height, max_dim, scale_parameter);
+    FFTr2c FFT_src(planes.begin(), padded_width, padded_height, src.GetNumOfChannels());
+    FFT_src.ForwardTransform();
+    FFT_src.MultiplyOutByReal(*response);    // apply filter to every channel
     FFT_src.InverseTransform();
-    return Crop(white, width_field, height_field);
+    Channel<float> blurred(src.GetWidth(), src.GetHeight());
+    for (int channel = 0; channel != src.GetNumOfChannels(); ++channel) {
+        const float* plane = planes.begin() + planes.GetChannelOffset(channel);
+        for (int y = 0; y != src.GetHeight(); ++y) {
+            const float* row = plane + size_t(y + padding.top) * padded_width + padding.left;
+            std::copy(row, row + src.GetWidth(), blurred.begin() + size_t(y) * src.GetWidth());
+        }
+        LoadFromChannel(result, blurred, channel);
+    }
+    return result;
+}
+
+Channel<float> ApplyGaussianBlurDCT(const Channel<float>& src, int scale_parameter) {
+    const int width = src.GetWidth();
+    const int height = src.GetHeight();
+    Channel<float> result(src);
+    ForwardDCT(result.begin(), width, height);
+    // The kernel exp(-(d * scale_parameter / max_dim)^2) has the transfer function
+    // exp(-(pi * f * max_dim / scale_parameter)^2); the k-th DCT coefficient of n has the frequency
+    // f = k / (2 * n). The factors include the normalization of DCT-III by 4 * width * height.
+    constexpr double PI = 3.14159265358979323846;
+    const double spread = PI * std::max(width, height) / scale_parameter;
+    auto transfer_function = [spread](int n) {
+        std::vector<float> factors(n);
+        for (int k = 0; k != n; ++k) {
+            double arg = spread * k / (2.0 * n);
+            factors[k] = float(std::exp(-arg * arg) / (2.0 * n));
+        }
+        return factors;
+    };
+    const std::vector<float> factors_x = transfer_function(width);
+    const std::vector<float> factors_y = transfer_function(height);
+    float* ptr = result.begin();
+    ParallelForItems<float>(height, width, [&](size_t row_begin, size_t row_end) {
+        for (size_t y = row_begin; y != row_end; ++y) {
+            float* row = ptr + y * width;
+            for (int x = 0; x != width; ++x) {
+                row[x] *= factors_y[y] * factors_x[x];
+            }
+        }
+    });
+    InverseDCT(result.begin(), width, height);
+    return result;
+}
+
+Channel<float> ApplyGaussianBlurRecursive(const Channel<float>& src, int scale_parameter) {
+    const double sigma = GetGaussianSigma(src, scale_parameter);
+    if (sigma < 0.5) {
+        throw std::runtime_error("Standard deviation of recursive blur must be >= 0.5 pixels");
+    }
+    const RecursiveGaussian filter(sigma);
+    const size_t width = src.GetWidth();
+    const size_t height = src.GetHeight();
+    Channel<float> result(src);
+    float* ptr = result.begin();
+    ParallelForItems<float>(height, width, [&](size_t row_begin, size_t row_end) {
+        std::vector<double> buffer;
+        for (size_t y = row_begin; y != row_end; ++y) {
+            filter.Filter(ptr + y * width, int(width), 1, 1, 0, buffer);
+        }
+    });
+    // Columns are filtered in groups, so every row of a group is read at once
+    constexpr size_t GROUP = 16;
+    const size_t num_of_groups = (width + GROUP - 1) / GROUP;
+    ParallelForItems<float>(num_of_groups, height * GROUP, [&](size_t begin, size_t end) {
+        std::vector<double> buffer;
+        for (size_t group = begin; group != end; ++group) {
+            size_t x = group * GROUP;
+            filter.Filter(ptr + x, int(height), int(std::min(GROUP, width - x)), width, 1, buffer);
+        }
+    });
+    return result;
+}
+
+Channel<float> ApplyGaussianBlurTiled(const Channel<float>& src, int scale_parameter,
+                                      int tile_size) {
+    const double sigma = GetGaussianSigma(src, scale_parameter);
+    const int radius = int(std::ceil(4.0 * sigma));
+    std::vector<float> kernel(2 * radius + 1);
+    double sum = 0.0;
+    for (int x = -radius; x <= radius; ++x) {
+        double value = std::exp(-x * x / (2.0 * sigma * sigma));
+        kernel[x + radius] = float(value);
+        sum += value;
+    }
+    for (float& value : kernel) {
+        value = float(value / sum);
+    }
+    Channel<float> result(src.GetWidth(), src.GetHeight());
+    ConvolveTiled(src.begin(), result.begin(), src.GetWidth(), src.GetHeight(), kernel, radius,
+                  tile_size);
+    return result;
 }
 
 Channel<float> Downscale(const Channel<float>& other, int target_size) {
@@ -175,82 +663,67 @@ Channel<float> Downscale(const Channel<float>& other, int target_size) {
         int rem_x = other.GetWidth() - (dst_width * step);
         int dst_height = other.GetHeight() / step;
         Channel<float> dst(dst_width, dst_height);
-        auto dst_iter = dst.begin();
-        auto src_iter = other.begin();
-        for (int i = 0; i != dst_height; ++i) {
-            std::vector<float> current_row(dst_width, 0);
-            for (int col_steps = 0; col_steps != step; ++col_steps) {
+        const float* src_ptr = other.begin();
+        float* dst_ptr = dst.begin();
+        const size_t src_rows_size = size_t(step) * other.GetWidth();
+        // Rows of dst are independent
+        ParallelForItems<float>(dst_height, src_rows_size, [&](size_t begin, size_t end) {
+            std::vector<float> current_row(dst_width);
+            for (size_t i = begin; i != end; ++i) {
+                std::fill(current_row.begin(), current_row.end(), 0.0f);
+                const float* src_iter = src_ptr + i * src_rows_size;
+                for (int col_steps = 0; col_steps != step; ++col_steps) {
+                    for (int j = 0; j != dst_width; ++j) {
+                        const float* after_step_iter = src_iter + step;
+                        current_row[j] += std::accumulate(src_iter, after_step_iter, 0.0f);
+                        src_iter = after_step_iter;
+                    }
+                    src_iter += rem_x;
+                }
+                float* dst_iter = dst_ptr + i * dst_width;
                 for (int j = 0; j != dst_width; ++j) {
-                    auto after_step_iter = std::next(src_iter, step);
-                    current_row[j] += std::accumulate(src_iter, after_step_iter, 0.0f);
-                    src_iter = after_step_iter;
+                    dst_iter[j] = current_row[j] / step / step;
                 }
-                std::advance(src_iter, rem_x);
-            }
-            for (int j = 0; j != dst_width; ++j) {
-                *dst_iter++ = current_row[j] / step / step;
             }
-        }
+        });
         return dst;
     }
 }
 
 Channel<float> PadReflect(const Channel<float>& other, int add_width, int add_height) {
-    Channel<float> dst(other.GetWidth() + 2 * add_width, other.GetHeight() + 2 * add_height);
-    auto dst_iter = std::next(dst.begin(), dst.GetWidth() * add_height);
-    auto other_iter = other.begin();
-    // main body
-    for (int _ex = 0; _ex != other.GetHeight(); ++_ex) {
-        std::advance(dst_iter, add_width);
-        auto end_row_iter = std::next(dst_iter, other.GetWidth());
-        for (; dst_iter != end_row_iter; ++dst_iter) {
-            *dst_iter = *other_iter++;
-        }
-        std::advance(dst_iter, add_width);
-    }
-    // left field
-    dst_iter = std::next(dst.begin(), dst.GetWidth() * add_height);
-    other_iter = other.begin();
-    for (int _ = 0; _ != other.GetHeight(); ++_) {
-        std::advance(other_iter, add_width);
-        auto end_row_iter = std::next(dst_iter, add_width);
-        for (; dst_iter != end_row_iter; ++dst_iter) {
-            *dst_iter = *other_iter--;
+    return PadReflect(other, add_width, add_height, add_width, add_height);
+}
+
+Channel<float> PadReflect(const Channel<float>& other, int add_left, int add_top, int add_right,
+                          int add_bottom) {
+    const int width = other.GetWidth();
+    const int height = other.GetHeight();
+    Channel<float> dst(width + add_left + add_right, height + add_top + add_bottom);
+    // Reflection about the border pixels, which are not repeated
+    auto reflect = [](int i, int n) {
+        if (n == 1) {
+            return 0;
         }
-        std::advance(other_iter, other.GetWidth());
-        std::advance(dst_iter, dst.GetWidth() - add_width);
-    }
-    // right field
-    dst_iter = std::next(dst.begin(), dst.GetWidth() * add_height);
-    other_iter = std::next(other.begin(), other.GetWidth() - 2);
-    for (int _ = 0; _ != other.GetHeight(); ++_) {
-        std::advance(dst_iter, other.GetWidth() + add_width);
-        auto end_row_iter = std::next(dst_iter, add_width);
-        for (; dst_iter != end_row_iter; ++dst_iter) {
-            *dst_iter = *other_iter--;
+        while (i < 0 || i >= n) {
+            i = i < 0 ? -i : 2 * n - 2 - i;
         }
-        std::advance(other_iter, add_width + other.GetWidth());
-    }
-    // upper field
-    dst_iter = dst.begin();
-    float* line_begin = std::next(dst.begin(), dst.GetWidth() * add_height * 2);
-    float* line_end = std::next(line_begin, dst.GetWidth());
-    for (int _ = 0; _ != add_height; ++_) {
-        std::copy(line_begin, line_end, dst_iter);
-        std::advance(line_begin, -dst.GetWidth());
-        std::advance(line_end, -dst.GetWidth());
-        std::advance(dst_iter, dst.GetWidth());
-    }
-    // lower field
-    dst_iter = std::next(dst.begin(), (add_height + other.GetHeight()) * dst.GetWidth());
-    line_begin = std::next(dst_iter, -2 * dst.GetWidth());
-    line_end = std::next(line_begin, dst.GetWidth());
-    for (int _ = 0; _ != add_height; ++_) {
-        std::copy(line_begin, line_end, dst_iter);
-        std::advance(line_begin, -dst.GetWidth());
-        std::advance(line_end, -dst.GetWidth());
-        std::advance(dst_iter, dst.GetWidth());
+        return i;
+    };
+    std::vector<int> columns(dst.GetWidth());
+    for (int x = 0; x != dst.GetWidth(); ++x) {
+        columns[x] = reflect(x - add_left, width);
     }
+    const float* src_ptr = other.begin();
+    float* dst_ptr = dst.begin();
+    ParallelForItems<float>(dst.GetHeight(), dst.GetWidth(), [&](size_t begin, size_t end) {
+        for (size_t y = begin; y != end; ++y) {
+            const float* src_row = src_ptr + size_t(reflect(int(y) - add_top, height)) * width;
+            float* dst_row = dst_ptr + y * dst.GetWidth();
+            for (int x = 0; x != dst.GetWidth(); ++x) {
+                dst_row[x] = src_row[columns[x]];
+            }
+        }
+    });
     return dst;
 }
 
@@ -265,12 +738,17 @@ Channel<float> GetAdaptMatrix(const Channel<float>& white) {
       // in FL first term is very very small. FL is the luminance level adaptation factor.
       Channel FL = 0.2 * k_in4 * (5 * La) + 0.1 * Powf((1 - k_in4), 2.0f) * Powf(5.0f * La, 1/3.0f);
       ================================= */
-    // ====================Reduced formulas
-    // k_in4
+    // ====================Reduced formulas, see GetAdaptFactor()
     Channel<float> result(white.GetWidth(), white.GetHeight());
-    result = Pow4(1.0f / (white + 1.0f));
-    // FL
-    result = 0.2f * result * white + 0.1f * Square(1 - result) * Cbrt(white);
+    const float* src_ptr = white.begin();
+    float* dst_ptr = result.begin();
+    math::WithAccuracy([&](auto accuracy) {
+        ParallelForItems<float>(result.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i != end; ++i) {
+                dst_ptr[i] = GetAdaptFactor(src_ptr[i], accuracy);
+            }
+        });
+    });
     return result;
 }
 
@@ -278,53 +756,120 @@ Image<float> IPTAdapt(const Image<float>& XYZ, float max_L) {
     if (XYZ.GetColorSpace() != ColorSpace::XYZ) {
         throw std::runtime_error("Only for XYZ images");
     }
-    auto max_Y = MinMaxValues(XYZ)[3];
-    Image<float> result(XYZ.GetColorSpace(), XYZ.GetWidth(), XYZ.GetHeight(),
+    // to normalized luminance again; the scaling is folded into the matrix
+    const float scale = max_L / Max(ChannelView(XYZ, 1))[0];
+    TransferMatrix lms_from_xyz = DST_FROM_SRC.at({ColorSpace::LMS, ColorSpace::XYZ});
+    for (float* row : {lms_from_xyz.row1, lms_from_xyz.row2, lms_from_xyz.row3}) {
+        std::transform(row, row + 3, row, [scale](float value) { return value * scale; });
+    }
+    const TransferMatrix ipt_from_lms = DST_FROM_SRC.at({ColorSpace::IPT, ColorSpace::LMS});
+    const TransferMatrix lms_from_ipt = DST_FROM_SRC.at({ColorSpace::LMS, ColorSpace::IPT});
+    const TransferMatrix xyz_from_lms = DST_FROM_SRC.at({ColorSpace::XYZ, ColorSpace::LMS});
+    const float gamma = 0.43f;    // gamma in Icam06 = 0.43
+    Image<float> result(XYZ.GetColorSpace(), XYZ.GetLayout(), XYZ.GetWidth(), XYZ.GetHeight(),
                         XYZ.GetNumOfChannels());
-    result = XYZ * (max_L / max_Y);    // to normalized luminance again
-    Channel<float> FL = CopyChannel(result, 1);
-    FL = GetAdaptMatrix(FL);
-    result.ChangeColorSpace(ColorSpace::LMS);
-    result = Pow(Abs(result), 0.43f);    // gamma in Icam06 = 0.43
-    result.ChangeColorSpace(ColorSpace::IPT);
-    auto FL_iter = FL.begin();
-    for (auto iter = result.begin(); iter != result.end(); std::advance(iter, 3)) {
-        auto M_iter = std::next(iter, 1);
-        auto S_iter = std::next(iter, 2);
-        float c_val = std::sqrt(*M_iter * *M_iter + *S_iter * *S_iter);
-        c_val = (1.29f * c_val * c_val - 0.27f * c_val + 0.42f) /
-                (c_val * c_val - 0.31f * c_val + 0.42f);
-        float FL_val = std::pow(*FL_iter + 1, 0.15f);
-        *M_iter *= FL_val * c_val;
-        *S_iter *= FL_val * c_val;
-        FL_iter++;
-    }
-    /*       # Bartleson surround adjustment
-        img_cor[:,:,0] = img_cor[:,:,0] * max_i           // gamma = 1  in ICam06HDR
-        max_i = np.amax(img_cor[:,:,0])
-        img_cor[:,:,0] /= max_i
-        img_cor[:,:,0] = np.power(img_cor[:,:,0], gamma) */
-    result.ChangeColorSpace(ColorSpace::LMS);
-    result = Pow(Abs(result), 1.0f / 0.43f);    // gamma in Icam06 = 1/0.43
-    result.ChangeColorSpace(ColorSpace::XYZ);
-    max_Y = MinMaxValues(result)[3];
+    const int width = XYZ.GetWidth();
+    const size_t stride = XYZ.GetPixelStride();
+    const float* src_ptrs[3];
+    float* dst_ptrs[3];
+    for (int channel = 0; channel != 3; ++channel) {
+        src_ptrs[channel] = XYZ.begin() + XYZ.GetChannelOffset(channel);
+        dst_ptrs[channel] = result.begin() + result.GetChannelOffset(channel);
+    }
+    // A row is converted from XYZ to IPT and back in buffers which stay in the cache; loops over
+    // contiguous values are vectorized. The maximum of Y is found in the same pass.
+    float max_Y = 0.0f;
+    std::mutex max_mutex;
+    math::WithAccuracy([&](auto accuracy) {
+        ParallelForItems<float>(XYZ.GetHeight(), size_t(width) * 3, [&](size_t begin, size_t end) {
+            // L, M and S (or I, P and T) values of a row one after another
+            std::vector<float> lms(size_t(width) * 3);
+            std::vector<float> fl_factor(width);
+            float* L_ptr = lms.data();
+            float* M_ptr = L_ptr + width;
+            float* S_ptr = M_ptr + width;
+            float local_max = 0.0f;
+            for (size_t y = begin; y != end; ++y) {
+                const size_t offset = y * width * stride;
+                const float* X_ptr = src_ptrs[0] + offset;
+                const float* Y_ptr = src_ptrs[1] + offset;
+                const float* Z_ptr = src_ptrs[2] + offset;
+                for (int x = 0; x != width; ++x) {
+                    const size_t i = x * stride;
+                    auto [L, M, S] =
+                        ApplyTransferMatrix(lms_from_xyz, X_ptr[i], Y_ptr[i], Z_ptr[i]);
+                    L_ptr[x] = L;
+                    M_ptr[x] = M;
+                    S_ptr[x] = S;
+                    fl_factor[x] = Y_ptr[i] * scale;
+                }
+                for (float& value : fl_factor) {
+                    value = math::Pow(GetAdaptFactor(value, accuracy) + 1, 0.15f, accuracy);
+                }
+                for (float& value : lms) {
+                    value = math::Pow(std::abs(value), gamma, accuracy);
+                }
+                for (int x = 0; x != width; ++x) {
+                    auto [I, P, T] =
+                        ApplyTransferMatrix(ipt_from_lms, L_ptr[x], M_ptr[x], S_ptr[x]);
+                    float c_val = std::sqrt(P * P + T * T);
+                    c_val = (1.29f * c_val * c_val - 0.27f * c_val + 0.42f) /
+                            (c_val * c_val - 0.31f * c_val + 0.42f);
+                    P *= fl_factor[x] * c_val;
+                    T *= fl_factor[x] * c_val;
+                    /*       # Bartleson surround adjustment
+                        img_cor[:,:,0] = img_cor[:,:,0] * max_i           // gamma = 1  in ICam06HDR
+                        max_i = np.amax(img_cor[:,:,0])
+                        img_cor[:,:,0] /= max_i
+                        img_cor[:,:,0] = np.power(img_cor[:,:,0], gamma) */
+                    auto [L, M, S] = ApplyTransferMatrix(lms_from_ipt, I, P, T);
+                    L_ptr[x] = L;
+                    M_ptr[x] = M;
+                    S_ptr[x] = S;
+                }
+                for (float& value : lms) {
+                    value = math::Pow(std::abs(value), 1.0f / gamma, accuracy);
+                }
+                float* dst_X_ptr = dst_ptrs[0] + offset;
+                float* dst_Y_ptr = dst_ptrs[1] + offset;
+                float* dst_Z_ptr = dst_ptrs[2] + offset;
+                for (int x = 0; x != width; ++x) {
+                    const size_t i = x * stride;
+                    auto [X, Y, Z] =
+                        ApplyTransferMatrix(xyz_from_lms, L_ptr[x], M_ptr[x], S_ptr[x]);
+                    dst_X_ptr[i] = X;
+                    dst_Y_ptr[i] = Y;
+                    dst_Z_ptr[i] = Z;
+                    local_max = std::max(local_max, Y);
+                }
+            }
+            std::lock_guard<std::mutex> lock(max_mutex);
+            max_Y = std::max(max_Y, local_max);
+        });
+    });
     result /= max_Y;
     return result;
 }
 
-Channel<float> RgbToBWCorrectedLab(Image<float>& img_rgb) {
-    if (img_rgb.GetColorSpace() != ColorSpace::RGB) {
-        throw std::runtime_error("Only for linear RGB images");
+void ConvertRgbToBWCorrectedLab(Image<float>& img_rgb, AdaptationQuality quality) {
+    if (img_rgb.GetColorSpace() != ColorSpace::RGB && img_rgb.GetColorSpace() != ColorSpace::XYZ) {
+        throw std::runtime_error("Only for linear RGB and XYZ images");
+    }
+    if (img_rgb.GetColorSpace() == ColorSpace::RGB) {
+        img_rgb.ChangeColorSpace(ColorSpace::XYZ);
     }
-    img_rgb.ChangeColorSpace(ColorSpace::XYZ);
-    img_rgb = LocLightAdapt(img_rgb);
+    img_rgb = LocLightAdapt(img_rgb, quality);
     img_rgb = IPTAdapt(img_rgb);
     img_rgb.ChangeColorSpace(ColorSpace::Lab);
-    Channel<float> lightness = CopyChannel(img_rgb, 0);
-    const auto [lower_bound, upper_bound] = lightness.Percentile(.2f / 256, 255.8f / 256);
-    lightness.Rescale(lower_bound, upper_bound, 0.0f, 100.0f);
-    LoadFromChannel(img_rgb, lightness, 0);
-    return lightness;
+    ArrayView<float> lightness = ChannelView(img_rgb, 0);
+    const auto [lower_bound, upper_bound] =
+        MakeQuantileSketch(lightness).Percentile(.2f / 256, 255.8f / 256);
+    Rescale(lightness, lower_bound, upper_bound, 0.0f, 100.0f);
+}
+
+Channel<float> RgbToBWCorrectedLab(Image<float>& img_rgb, AdaptationQuality quality) {
+    ConvertRgbToBWCorrectedLab(img_rgb, quality);
+    return CopyChannel(img_rgb, 0);
 }
 
 Image<float> GetEqualizedXYZFromLab(const Image<float>& src_Lab, Channel<float>& lightness) {
@@ -338,4 +883,109 @@ Image<float> GetEqualizedXYZFromLab(const Image<float>& src_Lab, Channel<float>&
     return result;
 }
 
+Image<float> GetEqualizedXYZFromLab(const Image<float>& src_Lab, Equalization mode,
+                                    const CLAHESettings& settings) {
+    if (src_Lab.GetColorSpace() != ColorSpace::Lab) {
+        throw std::runtime_error("Only for Lab images");
+    }
+    Image<float> result = src_Lab;
+    if (mode == Equalization::Adaptive) {
+        EqualizeAdaptive(ChannelView(result, 0), 0.0f, 100.0f, settings);
+    } else {
+        Equalize(ChannelView(result, 0), 0.0f, 100.0f);
+    }
+    result.ChangeColorSpace(ColorSpace::XYZ);
+    return result;
+}
+
+void EqualizeAdaptive(const ArrayView<float>& view, float out_min, float out_max,
+                      const CLAHESettings& settings) {
+    if (settings.tiles_x < 1 || settings.tiles_y < 1 || settings.num_of_bins < 2) {
+        throw std::runtime_error("CLAHE needs at least 1 tile and 2 bins");
+    }
+    const int width = view.GetWidth();
+    const int height = view.GetHeight();
+    if (width == 0 || height == 0) {
+        return;
+    }
+    const auto min_max = MinMax(view);
+    const float in_min = min_max[0];
+    const int bins = settings.num_of_bins;
+    const float scale = min_max[1] > in_min ? bins / (min_max[1] - in_min) : 0.0f;
+    auto bin_of = [in_min, scale, bins](float value) {
+        return std::min(int((value - in_min) * scale), bins - 1);
+    };
+    const int tile_w = (width + settings.tiles_x - 1) / settings.tiles_x;
+    const int tile_h = (height + settings.tiles_y - 1) / settings.tiles_y;
+    const int tiles_x = (width + tile_w - 1) / tile_w;
+    const int tiles_y = (height + tile_h - 1) / tile_h;
+    // Mapping of the bins of every tile to output values
+    std::vector<float> luts(size_t(tiles_x) * tiles_y * bins);
+    ParallelForTiles(width, height, tile_w, tile_h, [&](int x, int y, int w, int h) {
+        std::vector<int> hist(bins, 0);
+        for (int row = y; row != y + h; ++row) {
+            for (int col = x; col != x + w; ++col) {
+                ++hist[bin_of(view.At(col, row))];
+            }
+        }
+        const int num_of_pixels = w * h;
+        const int limit = std::max(int(settings.clip_limit * num_of_pixels / bins), 1);
+        int excess = 0;
+        for (int& count : hist) {
+            excess += std::max(count - limit, 0);
+            count = std::min(count, limit);
+        }
+        // The remainder is spread evenly too, not given to the darkest bins
+        const int remainder = excess % bins;
+        for (int i = 0; i != bins; ++i) {
+            hist[i] += excess / bins;
+        }
+        for (int i = 0; i != remainder; ++i) {
+            ++hist[i * bins / remainder];
+        }
+        float* lut = luts.data() + (size_t(y / tile_h) * tiles_x + x / tile_w) * bins;
+        int cum_sum = 0;
+        for (int i = 0; i != bins; ++i) {
+            cum_sum += hist[i];
+            lut[i] = float(cum_sum) / num_of_pixels * (out_max - out_min) + out_min;
+        }
+    });
+    // Nearest tiles and interpolation weights of a coordinate; tiles are centered at
+    // (tile + 0.5) * size
+    struct Neighbours {
+        int first;
+        int second;
+        float weight;    // of the second tile
+    };
+    auto neighbours = [](int coord, int size, int num_of_tiles) {
+        float pos = (coord + 0.5f) / size - 0.5f;
+        int first = std::clamp(int(std::floor(pos)), 0, num_of_tiles - 1);
+        int second = std::min(first + 1, num_of_tiles - 1);
+        float weight = std::clamp(pos - first, 0.0f, 1.0f);
+        return Neighbours{first, second, second == first ? 0.0f : weight};
+    };
+    std::vector<Neighbours> cols(width);
+    for (int x = 0; x != width; ++x) {
+        cols[x] = neighbours(x, tile_w, tiles_x);
+    }
+    ParallelForItems<float>(height, width, [&](size_t row_begin, size_t row_end) {
+        for (size_t y = row_begin; y != row_end; ++y) {
+            const Neighbours row = neighbours(int(y), tile_h, tiles_y);
+            const float* upper = luts.data() + size_t(row.first) * tiles_x * bins;
+            const float* lower = luts.data() + size_t(row.second) * tiles_x * bins;
+            float* ptr = &view.At(0, int(y));
+            for (int x = 0; x != width; ++x) {
+                float& value = ptr[x * view.GetPixelStride()];
+                const Neighbours& col = cols[x];
+                const int bin = bin_of(value);
+                const size_t left = size_t(col.first) * bins + bin;
+                const size_t right = size_t(col.second) * bins + bin;
+                float top = upper[left] + col.weight * (upper[right] - upper[left]);
+                float bottom = lower[left] + col.weight * (lower[right] - lower[left]);
+                value = top + row.weight * (bottom - top);
+            }
+        }
+    });
+}
+
 }    // namespace pg::ops
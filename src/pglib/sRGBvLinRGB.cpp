@@ -1,5 +1,8 @@
 #include "PhotoGoodyzer/sRGBvLinRGB.h"
 
+#include <cstdint>
+#include <cstring>
+
 namespace pg {
 
 // A table of precalculated values
@@ -48,4 +51,30 @@ std::vector<float> UCHAR_TO_RGB{
     0.921582f,    0.9301109f,   0.9386859f,   0.9473066f,   0.9559735f,   0.9646863f,
     0.9734455f,   0.9822506f,   0.9911022f,   1.0f};
 
+const float* GetSRGBThresholds() {
+    static const std::vector<float> thresholds = [] {
+        std::vector<float> result(256, 0.0f);
+        std::uint32_t lower = 0;
+        for (int code = 1; code != 256; ++code) {
+            // bit patterns of non-negative floats are ordered as the floats themselves
+            std::uint32_t upper;
+            float one = 1.0f;
+            std::memcpy(&upper, &one, sizeof(upper));
+            while (lower < upper) {
+                std::uint32_t middle = lower + (upper - lower) / 2;
+                float value;
+                std::memcpy(&value, &middle, sizeof(value));
+                if (linRGB_to_sRGB(value) >= code) {
+                    upper = middle;
+                } else {
+                    lower = middle + 1;
+                }
+            }
+            std::memcpy(&result[code], &lower, sizeof(float));
+        }
+        return result;
+    }();
+    return thresholds.data();
+}
+
 }    // namespace pg
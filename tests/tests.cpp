@@ -3,7 +3,10 @@
 #include "tests.h"
 
 #include <catch.hpp>
+#include <thread>
 
+#include "../src/pglib/FFT.h"
+#include "../src/pglib/PowTable.h"
 #include "PhotoGoodyzer.h"
 
 using namespace pg;
@@ -128,4 +131,1249 @@ TEST_CASE(
         Channel<int> result(chan.GetWidth(), chan.GetHeight());
         RequireExprValueFunc(result, chan, src_val);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE(
+    "Batched evaluation of expression templates"
+    "[Expression templates][Channel]") {
+    // 37 * 5 elements: several full packs and a scalar tail
+    Channel<float> src(37, 5);
+    Channel<float> white(37, 5);
+    for (size_t i = 0; i != src.size(); ++i) {
+        src[i] = 0.01f * i - 0.5f;
+        white[i] = 0.1f * i + 1.0f;
+    }
+    Channel<float> result(src.GetWidth(), src.GetHeight());
+    result = 0.2f * src * white + 0.1f * Square(1 - src) * Cbrt(white) + Pow(Abs(src), 0.43f) -
+             Sqrt(white) / Pow3(white) * Pow4(src);
+    for (size_t i = 0; i != result.size(); ++i) {
+        float s = src[i], w = white[i];
+        float cor_ans = 0.2f * s * w + 0.1f * (1 - s) * (1 - s) * std::cbrt(w) +
+                        std::pow(std::abs(s), 0.43f) - std::sqrt(w) / (w * w * w) * s * s * s * s;
+        REQUIRE(result[i] == Approx(cor_ans));
+    }
+}
+
+/// Sets parallel settings and restores the previous ones on scope exit, even if a REQUIRE throws
+struct ScopedParallelSettings {
+    const ParallelSettings saved = GetParallelSettings();
+
+    explicit ScopedParallelSettings(const ParallelSettings& settings) {
+        SetParallelSettings(settings);
+    }
+    ScopedParallelSettings(const ScopedParallelSettings&) = delete;
+    ScopedParallelSettings& operator=(const ScopedParallelSettings&) = delete;
+    ~ScopedParallelSettings() { SetParallelSettings(saved); }
+};
+
+TEST_CASE(
+    "Parallel evaluation of expression templates"
+    "[Expression templates][Image]") {
+    Image<float> src(ColorSpace::XYZ, 301, 7, 3);
+    for (size_t i = 0; i != src.size(); ++i) {
+        src[i] = 0.001f * i;
+    }
+    Image<float> serial(src.GetColorSpace(), src.GetWidth(), src.GetHeight(),
+                        src.GetNumOfChannels());
+    serial = Pow(Abs(src - 1.0f), 0.43f) * 2.0f + src;
+    ParallelSettings settings;
+    settings.num_threads = GENERATE(2, 3, 8);
+    settings.serial_threshold = 0;
+    settings.chunk_bytes = 256;
+    ScopedParallelSettings scoped_settings(settings);
+    Image<float> parallel(src.GetColorSpace(), src.GetWidth(), src.GetHeight(),
+                          src.GetNumOfChannels());
+    parallel = Pow(Abs(src - 1.0f), 0.43f) * 2.0f + src;
+    REQUIRE(std::equal(parallel.begin(), parallel.end(), serial.begin()));
+}
+
+TEST_CASE(
+    "Reductions of arrays and expression templates"
+    "[Reductions][Expression templates][Image]") {
+    Image<float> img(ColorSpace::XYZ, 641, 121, 3);
+    for (size_t i = 0; i != img.size(); ++i) {
+        img[i] = std::sin(0.37f * i) * (i % 3 + 1);
+    }
+    std::vector<double> sums(3, 0.0);
+    std::vector<float> min_max = {img[0], img[0], img[1], img[1], img[2], img[2]};
+    for (size_t i = 0; i != img.size(); ++i) {
+        float value = std::abs(img[i]) * 2.0f;
+        sums[i % 3] += value;
+        min_max[2 * (i % 3)] = std::min(min_max[2 * (i % 3)], img[i]);
+        min_max[2 * (i % 3) + 1] = std::max(min_max[2 * (i % 3) + 1], img[i]);
+    }
+    SECTION("Per channel") {
+        auto sum = Sum(Abs(img) * 2.0f, 3);
+        auto mean = Mean(Abs(img) * 2.0f, 3);
+        for (int channel = 0; channel != 3; ++channel) {
+            REQUIRE(sum[channel] == Approx(sums[channel]));
+            REQUIRE(mean[channel] == Approx(sums[channel] / img.GetImgSize()));
+            REQUIRE(Min(img, 3)[channel] == min_max[2 * channel]);
+            REQUIRE(Max(img, 3)[channel] == min_max[2 * channel + 1]);
+        }
+        REQUIRE(MinMax(img, 3) == min_max);
+        REQUIRE(MinMaxValues(img) == min_max);
+    }
+    SECTION("Whole array") {
+        REQUIRE(Sum(Abs(img) * 2.0f)[0] == Approx(sums[0] + sums[1] + sums[2]));
+        REQUIRE(Min(img)[0] == *std::min_element(min_max.begin(), min_max.end()));
+        REQUIRE(Max(img)[0] == *std::max_element(min_max.begin(), min_max.end()));
+    }
+    SECTION("Channels with disjoint ranges") {
+        std::vector<int> values = {0, 10, -10, 1, 11, -11, 2, 12, -12};
+        REQUIRE(Min(values, 3) == std::vector<int>{0, 10, -12});
+        REQUIRE(Max(values, 3) == std::vector<int>{2, 12, -10});
+        REQUIRE(MinMax(values, 3) == std::vector<int>{0, 2, 10, 12, -12, -10});
+    }
+    SECTION("Results do not depend on the number of threads") {
+        auto serial = Sum(Abs(img) * 2.0f, 3);
+        ParallelSettings settings;
+        settings.num_threads = 4;
+        settings.serial_threshold = 0;
+        ScopedParallelSettings scoped_settings(settings);
+        auto parallel = Sum(Abs(img) * 2.0f, 3);
+        REQUIRE(parallel == serial);
+    }
+}
+
+class CountingResource : public MemoryResource {
+private:
+    AlignedResource upstream_;
+
+public:
+    int allocations = 0;
+    int deallocations = 0;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocations;
+        return upstream_.Allocate(bytes, alignment);
+    }
+
+    void Deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        ++deallocations;
+        upstream_.Deallocate(ptr, bytes, alignment);
+    }
+};
+
+TEST_CASE(
+    "Memory resources"
+    "[Allocator][Image][Channel]") {
+    SECTION("Default arrays are aligned") {
+        Channel<float> chan(123, 45);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(chan.begin()) % ARRAY_ALIGNMENT == 0);
+    }
+    SECTION("Huge page aligned arrays") {
+        AlignedResource resource(AlignedResource::HUGE_PAGE_SIZE);
+        Image<float> img(ColorSpace::XYZ, 1000, 1000, 3, &resource);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(img.begin()) % AlignedResource::HUGE_PAGE_SIZE ==
+                0);
+        img.Fill(1.0f);
+        REQUIRE(Sum(img)[0] == 3'000'000);
+    }
+    SECTION("Custom resource") {
+        CountingResource resource;
+        {
+            Image<float> img(ColorSpace::XYZ, 10, 10, 3, &resource);
+            Channel<int> chan(10, 10, &resource);
+            REQUIRE(resource.allocations == 2);
+            REQUIRE(resource.deallocations == 0);
+        }
+        REQUIRE(resource.deallocations == 2);
+    }
+}
+
+TEST_CASE(
+    "Scratch arena"
+    "[Allocator][Image][Channel]") {
+    CountingResource upstream;
+    {
+        ScratchArena arena(&upstream);
+        float* first_ptr = nullptr;
+        for (int _ = 0; _ != 3; ++_) {
+            ScopedResource scratch(&arena);
+            Image<float> img(ColorSpace::XYZ, 64, 32, 1);
+            img.Fill(1.0f);
+            Channel<float> chan(64, 32);
+            chan = Sqrt(img + 3.0f);
+            REQUIRE(chan[0] == Approx(2.0f));
+            if (!first_ptr) {
+                first_ptr = img.begin();
+            }
+            REQUIRE(img.begin() == first_ptr);
+        }
+        REQUIRE(upstream.allocations == 2);
+        REQUIRE(upstream.deallocations == 0);
+        REQUIRE(arena.GetCachedBytes() == 2 * 64 * 32 * sizeof(float));
+        Channel<float> outside(64, 32);
+        REQUIRE(upstream.allocations == 2);
+    }
+    REQUIRE(upstream.deallocations == 2);
+}
+
+
+TEST_CASE(
+    "Views of channels and regions"
+    "[ArrayView][Image][Channel]") {
+    Image<float> img(ColorSpace::XYZ, 5, 4, 3);
+    for (size_t i = 0; i != img.size(); ++i) {
+        img[i] = float(i);
+    }
+    SECTION("Channel view of an interleaved image") {
+        ArrayView<float> green = ChannelView(img, 1);
+        REQUIRE(green.size() == 20);
+        REQUIRE(green.At(2, 1) == img[(1 * 5 + 2) * 3 + 1]);
+        REQUIRE(green[7] == img[7 * 3 + 1]);
+        REQUIRE(Sum(green)[0] == Approx(Sum(CopyChannel(img, 1))[0]));
+        green = green * 2.0f;
+        REQUIRE(img[1] == 2.0f);
+        REQUIRE(img[0] == 0.0f);
+        REQUIRE(img[2] == 2.0f);
+    }
+    SECTION("Region of a view") {
+        ArrayView<float> region = ChannelView(img, 2).Region(1, 1, 3, 2);
+        REQUIRE_FALSE(region.IsDense());
+        REQUIRE(region.At(0, 0) == img[(1 * 5 + 1) * 3 + 2]);
+        REQUIRE(region[4] == img[(2 * 5 + 2) * 3 + 2]);
+        region.Fill(-1.0f);
+        REQUIRE(Min(img)[0] == -1.0f);
+        REQUIRE(std::count(img.begin(), img.end(), -1.0f) == 6);
+        REQUIRE_THROWS(region.Region(1, 1, 3, 2));
+    }
+    SECTION("Expressions of views") {
+        const Image<float>& const_img = img;
+        ArrayView<const float> red = ChannelView(const_img, 0);
+        Channel<float> chan(5, 4);
+        chan = red + ChannelView(img, 1);
+        REQUIRE(chan[3] == img[9] + img[10]);
+        Channel<float> region(3, 3);
+        region = ChannelView(img, 0).Region(2, 1, 3, 3) * 1.0f;
+        REQUIRE(region[0] == img[(1 * 5 + 2) * 3]);
+        REQUIRE(region[8] == img[(3 * 5 + 4) * 3]);
+    }
+    SECTION("Rescaling and equalization in-place") {
+        ArrayView<float> blue = ChannelView(img, 2);
+        Rescale(blue, 20.0f, 41.0f);
+        REQUIRE(img[2] == 0.0f);
+        REQUIRE(img[img.size() - 1] == 1.0f);
+        Equalize(blue, 0.0f, 100.0f);
+        // 7 values are rescaled to 0; they are the darkest ones
+        REQUIRE(MinMax(blue)[1] == Approx(100.0f * (20 - 7) / 20));
+        REQUIRE(img[0] == 0.0f);
+    }
+}
+
+TEST_CASE(
+    "Planar layout"
+    "[Layout][Image][Channel]") {
+    Image<unsigned char> src_sRGB(ColorSpace::sRGB, 7, 5, 3);
+    for (size_t i = 0; i != src_sRGB.size(); ++i) {
+        src_sRGB[i] = (unsigned char)(i * 7 % 256);
+    }
+    Image<float> interleaved = LinRGBFromSRGB(src_sRGB);
+    Image<float> planar = LinRGBFromSRGB(src_sRGB, Layout::Planar);
+    REQUIRE(planar.GetLayout() == Layout::Planar);
+    REQUIRE(planar.GetPixelStride() == 1);
+    REQUIRE(planar.GetChannelOffset(2) == 2 * 35);
+    REQUIRE(planar[35 + 4] == interleaved[4 * 3 + 1]);
+    auto require_same_pixels = [](const Image<float>& lhs, const Image<float>& rhs) {
+        for (int channel = 0; channel != 3; ++channel) {
+            Channel<float> lhs_channel = CopyChannel(lhs, channel);
+            Channel<float> rhs_channel = CopyChannel(rhs, channel);
+            for (size_t i = 0; i != lhs_channel.size(); ++i) {
+                REQUIRE(lhs_channel[i] == Approx(rhs_channel[i]).margin(1e-5));
+            }
+        }
+    };
+    SECTION("Changing the layout") {
+        Image<float> copy = planar;
+        REQUIRE(copy.GetLayout() == Layout::Planar);
+        copy.ChangeLayout(Layout::Interleaved);
+        REQUIRE(std::equal(copy.begin(), copy.end(), interleaved.begin()));
+        Image<unsigned char> dst_sRGB = SRGBFromLinRGB(planar);
+        REQUIRE(dst_sRGB.GetLayout() == Layout::Interleaved);
+        REQUIRE(std::equal(dst_sRGB.begin(), dst_sRGB.end(), src_sRGB.begin()));
+        REQUIRE(MinMaxValues(planar) == MinMaxValues(interleaved));
+    }
+    SECTION("Color space transformations") {
+        for (ColorSpace clrs : {ColorSpace::XYZ, ColorSpace::Lab, ColorSpace::XYZ, ColorSpace::LMS,
+                                ColorSpace::IPT, ColorSpace::LMS, ColorSpace::XYZ}) {
+            planar.ChangeColorSpace(clrs);
+            interleaved.ChangeColorSpace(clrs);
+            require_same_pixels(planar, interleaved);
+        }
+        require_same_pixels(Image<float>(planar, ColorSpace::RGB),
+                            Image<float>(interleaved, ColorSpace::RGB));
+    }
+    SECTION("Operations") {
+        planar.ChangeColorSpace(ColorSpace::XYZ);
+        interleaved.ChangeColorSpace(ColorSpace::XYZ);
+        Image<float> planar_result = ops::IPTAdapt(ops::LocLightAdapt(planar));
+        REQUIRE(planar_result.GetLayout() == Layout::Planar);
+        require_same_pixels(planar_result, ops::IPTAdapt(ops::LocLightAdapt(interleaved)));
+        planar_result.ChangeColorSpace(ColorSpace::Lab);
+        Image<float> interleaved_result(planar_result);
+        interleaved_result.ChangeLayout(Layout::Interleaved);
+        require_same_pixels(ops::CorrectColorTemperature(planar_result),
+                            ops::CorrectColorTemperature(interleaved_result));
+        std::vector<Channel<float>> channels;
+        for (int channel = 0; channel != 3; ++channel) {
+            channels.push_back(CopyChannel(interleaved, channel));
+        }
+        LoadFromChannels(planar, channels);
+        require_same_pixels(planar, interleaved);
+    }
+    SECTION("Expressions over mixed layouts") {
+        Image<float> result(ColorSpace::RGB, Layout::Interleaved, 7, 5, 3);
+        REQUIRE_THROWS(result = planar * 2.0f);
+        REQUIRE_THROWS(planar + interleaved);
+        REQUIRE_THROWS(interleaved - Sqrt(planar));
+        result = interleaved * 2.0f;
+        Image<float> planar_result(ColorSpace::RGB, Layout::Planar, 7, 5, 3);
+        planar_result = planar + planar;
+        require_same_pixels(planar_result, result);
+        // The values of single-channel arrays do not depend on the layout
+        Channel<float> channel = CopyChannel(interleaved, 0);
+        Array<float> zeros(Layout::Planar, 7, 5, 1);
+        zeros.Fill(0.0f);
+        Channel<float> copy(7, 5);
+        copy = channel + zeros;
+        REQUIRE(std::equal(copy.begin(), copy.end(), channel.begin()));
+    }
+}
+
+TEST_CASE(
+    "Deferred color space transformations"
+    "[Image]") {
+    Image<float> rgb(ColorSpace::RGB, 9, 7, 3);
+    for (size_t i = 0; i != rgb.size(); ++i) {
+        rgb[i] = float(i % 17) / 16;
+    }
+    Image<float> eager_xyz(rgb, ColorSpace::XYZ);
+    Image<float> eager_lms(eager_xyz, ColorSpace::LMS);
+    SECTION("Consecutive matrices are applied at once") {
+        Image<float> img(rgb);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::LMS);
+        REQUIRE(img.HasPending());
+        REQUIRE(img.GetColorSpace() == ColorSpace::LMS);
+        Image<float> moved(std::move(img));
+        REQUIRE(moved.HasPending());
+        REQUIRE(moved[5] == Approx(eager_lms[5]).margin(1e-5));
+        REQUIRE_FALSE(moved.HasPending());
+        for (size_t i = 0; i != moved.size(); ++i) {
+            REQUIRE(moved[i] == Approx(eager_lms[i]).margin(1e-5));
+        }
+    }
+    SECTION("Round trip with clipping") {
+        Image<float> img(rgb);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::LMS);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::RGB);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        REQUIRE(img.HasPending());
+        img.Flush();
+        for (size_t i = 0; i != img.size(); ++i) {
+            REQUIRE(img[i] == Approx(eager_xyz[i]).margin(1e-4));
+        }
+    }
+    SECTION("Expressions, reductions and nonlinear transformations") {
+        Image<float> img(rgb);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        REQUIRE(Sum(img)[0] == Approx(Sum(eager_xyz)[0]));
+        img.ChangeColorSpace(ColorSpace::LMS);
+        img = img * 2.0f;
+        REQUIRE_FALSE(img.HasPending());
+        REQUIRE(img[10] == Approx(eager_lms[10] * 2.0f).margin(1e-5));
+        img = img / 2.0f;
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::Lab);
+        REQUIRE_FALSE(img.HasPending());
+        Image<float> eager_lab(eager_xyz, ColorSpace::Lab);
+        REQUIRE(img[3] == Approx(eager_lab[3]).margin(1e-3));
+    }
+    SECTION("Moved to an array") {
+        Image<float> img(rgb);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::LMS);
+        Array<float> array(std::move(img));
+        REQUIRE(array.HasPending());
+        for (size_t i = 0; i != array.size(); ++i) {
+            REQUIRE(array[i] == Approx(eager_lms[i]).margin(1e-5));
+        }
+    }
+    SECTION("Concurrent reads of a const image") {
+        Image<float> img(rgb);
+        img.ChangeColorSpace(ColorSpace::XYZ);
+        img.ChangeColorSpace(ColorSpace::LMS);
+        const Image<float>& shared = img;
+        std::vector<std::vector<float>> copies(4);
+        std::vector<std::thread> threads;
+        for (auto& copy : copies) {
+            threads.emplace_back([&shared, &copy] { copy.assign(shared.begin(), shared.end()); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE_FALSE(img.HasPending());
+        for (const auto& copy : copies) {
+            for (size_t i = 0; i != copy.size(); ++i) {
+                REQUIRE(copy[i] == Approx(eager_lms[i]).margin(1e-5));
+            }
+        }
+    }
+}
+
+TEST_CASE(
+    "Fused sRGB conversions"
+    "[Image][sRGB]") {
+    SECTION("Encoding with thresholds") {
+        const float* thresholds = GetSRGBThresholds();
+        for (int i = 0; i <= 100000; ++i) {
+            float value = i / 100000.0f;
+            REQUIRE(int(linRGB_to_sRGB(value, thresholds)) == int(linRGB_to_sRGB(value)));
+        }
+        REQUIRE(linRGB_to_sRGB(-0.5f, thresholds) == 0);
+        REQUIRE(linRGB_to_sRGB(1.5f, thresholds) == 255);
+    }
+    Image<unsigned char> src_sRGB(ColorSpace::sRGB, 16, 16, 3);
+    for (size_t i = 0; i != src_sRGB.size(); ++i) {
+        src_sRGB[i] = (unsigned char)(i * 11 % 256);
+    }
+    for (Layout layout : {Layout::Interleaved, Layout::Planar}) {
+        for (ColorSpace clrs : {ColorSpace::RGB, ColorSpace::XYZ, ColorSpace::Lab}) {
+            Image<float> fused = ImageFromSRGB(src_sRGB, clrs, layout);
+            Image<float> reference = LinRGBFromSRGB(src_sRGB, layout);
+            if (clrs != ColorSpace::RGB) {
+                reference.ChangeColorSpace(ColorSpace::XYZ);
+            }
+            if (clrs == ColorSpace::Lab) {
+                reference.ChangeColorSpace(ColorSpace::Lab);
+            }
+            REQUIRE(fused.GetColorSpace() == clrs);
+            REQUIRE(fused.GetLayout() == layout);
+            for (size_t i = 0; i != fused.size(); ++i) {
+                REQUIRE(fused[i] == Approx(reference[i]).margin(1e-4));
+            }
+            Image<unsigned char> dst_sRGB = SRGBFromImage(fused);
+            if (clrs == ColorSpace::Lab) {
+                reference.ChangeColorSpace(ColorSpace::XYZ);
+            }
+            if (clrs != ColorSpace::RGB) {
+                reference.ChangeColorSpace(ColorSpace::RGB);
+            }
+            Image<unsigned char> reference_sRGB = SRGBFromLinRGB(reference);
+            for (size_t i = 0; i != dst_sRGB.size(); ++i) {
+                REQUIRE(std::abs(int(dst_sRGB[i]) - int(src_sRGB[i])) <= 1);
+                REQUIRE(std::abs(int(dst_sRGB[i]) - int(reference_sRGB[i])) <= 1);
+            }
+        }
+    }
+    REQUIRE_THROWS(ImageFromSRGB(src_sRGB, ColorSpace::IPT));
+}
+
+class SerialExecutor : public Executor {
+public:
+    std::size_t num_of_runs = 0;
+
+    int GetConcurrency() const override { return 2; }
+
+    void Run(std::size_t num_of_tasks, const std::function<void(std::size_t)>& task) override {
+        ++num_of_runs;
+        for (std::size_t i = num_of_tasks; i-- != 0;) {
+            task(i);
+        }
+    }
+};
+
+TEST_CASE(
+    "Executors"
+    "[Parallel][Image]") {
+    ParallelSettings settings;
+    settings.num_threads = 3;
+    settings.serial_threshold = 0;
+    settings.chunk_bytes = 512;
+    ScopedParallelSettings scoped_settings(settings);
+    Image<float> src(ColorSpace::XYZ, 67, 45, 3);
+    for (size_t i = 0; i != src.size(); ++i) {
+        src[i] = 0.5f + 0.4f * std::sin(0.01f * i + (i % 3));
+    }
+    SECTION("Results do not depend on the executor") {
+        Image<float> pooled = ops::IPTAdapt(src);
+        SerialExecutor serial;
+        {
+            ScopedExecutor scoped(&serial);
+            REQUIRE(GetDefaultExecutor() == &serial);
+            Image<float> result = ops::IPTAdapt(src);
+            result.ChangeColorSpace(ColorSpace::Lab);
+            REQUIRE(serial.num_of_runs > 0);
+            pooled.ChangeColorSpace(ColorSpace::Lab);
+            REQUIRE(std::equal(result.begin(), result.end(), pooled.begin()));
+        }
+        REQUIRE(GetDefaultExecutor() != &serial);
+    }
+    SECTION("Thread pools") {
+        ThreadPool pool(4, {0});
+        REQUIRE(pool.GetConcurrency() == 4);
+        std::vector<int> counts(1000, 0);
+        pool.Run(counts.size(), [&counts](std::size_t i) { ++counts[i]; });
+        REQUIRE(std::all_of(counts.begin(), counts.end(), [](int count) { return count == 1; }));
+        SetDefaultExecutor(&pool);
+        REQUIRE(GetNumThreads() == 4);
+        REQUIRE_THROWS(ParallelFor(100, 1, [](std::size_t begin, std::size_t) {
+            if (begin == 42)
+                throw std::runtime_error("Failure");
+        }));
+        SetDefaultExecutor(nullptr);
+        REQUIRE(GetNumThreads() == 3);
+    }
+    SECTION("Tiles") {
+        std::vector<int> counts(31 * 17, 0);
+        ParallelForTiles(31, 17, 8, 5, [&counts](int x, int y, int width, int height) {
+            for (int row = y; row != y + height; ++row) {
+                for (int col = x; col != x + width; ++col) {
+                    ++counts[row * 31 + col];
+                }
+            }
+        });
+        REQUIRE(std::all_of(counts.begin(), counts.end(), [](int count) { return count == 1; }));
+    }
+}
+
+TEST_CASE(
+    "Percentiles and equalization from a histogram"
+    "[Channel][ArrayView]") {
+    Channel<float> chan(200, 150);
+    for (size_t i = 0; i != chan.size(); ++i) {
+        chan[i] = std::sin(0.013f * i) * 50.0f - 20.0f;
+    }
+    std::vector<float> sorted(chan.begin(), chan.end());
+    std::sort(sorted.begin(), sorted.end());
+    const float bin_width = (sorted.back() - sorted.front()) / 1000;
+    SECTION("Percentiles") {
+        auto [lower, upper] = chan.Percentile(0.1f, 0.8f);
+        REQUIRE(lower == Approx(sorted[sorted.size() / 10]).margin(bin_width));
+        REQUIRE(upper == Approx(sorted[sorted.size() * 8 / 10]).margin(bin_width));
+        REQUIRE(chan.Percentile() == std::make_pair(sorted.front(), sorted.back()));
+    }
+    SECTION("Equalization") {
+        ParallelSettings settings;
+        settings.serial_threshold = 0;
+        settings.chunk_bytes = 1024;
+        Channel<float> parallel(chan);
+        {
+            ScopedParallelSettings scoped_settings(settings);
+            parallel.Equalize(0.0f, 100.0f);
+        }
+        chan.Equalize(0.0f, 100.0f);
+        REQUIRE(std::equal(chan.begin(), chan.end(), parallel.begin()));
+        REQUIRE(Min(chan)[0] == 0.0f);
+        REQUIRE(Max(chan)[0] <= 100.0f);
+        // Equalized values are distributed almost evenly
+        REQUIRE(Mean(chan)[0] == Approx(50.0f).margin(3.0f));
+    }
+}
+
+TEST_CASE(
+    "Quantile sketches"
+    "[QuantileSketch][ArrayView]") {
+    Channel<float> chan(400, 250);
+    for (size_t i = 0; i != chan.size(); ++i) {
+        chan[i] = std::sin(0.37f * i) * std::cos(0.0011f * i) * 100.0f;
+    }
+    std::vector<float> sorted(chan.begin(), chan.end());
+    std::sort(sorted.begin(), sorted.end());
+    auto rank_of = [&sorted](float value) {
+        auto range = std::equal_range(sorted.begin(), sorted.end(), value);
+        return double(range.first - sorted.begin() + range.second - sorted.begin()) / 2 /
+               sorted.size();
+    };
+    QuantileSketch<float> sketch = MakeQuantileSketch(ArrayView<float>(chan));
+    REQUIRE(sketch.GetCount() == chan.size());
+    REQUIRE(sketch.GetNumOfRetained() < 1000);
+    SECTION("Rank error") {
+        for (double rank : {0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999}) {
+            REQUIRE(std::abs(rank_of(sketch.GetQuantile(rank)) - rank) <=
+                    sketch.GetNormalizedRankError(rank));
+        }
+        REQUIRE(sketch.Percentile() == std::make_pair(sorted.front(), sorted.back()));
+    }
+    SECTION("Black and white points") {
+        // The bounds of RgbToBWCorrectedLab are rescaled to 256 levels, their ranks are resolved
+        // to a tenth of the tails
+        const float lower_b = 0.2f / 256;
+        const float upper_b = 255.8f / 256;
+        auto [lower, upper] = sketch.Percentile(lower_b, upper_b);
+        REQUIRE(std::abs(rank_of(lower) - lower_b) <= 0.1 * lower_b);
+        REQUIRE(std::abs(rank_of(upper) - upper_b) <= 0.1 * (1 - upper_b));
+        const float level = (sorted.back() - sorted.front()) / 256;
+        REQUIRE(lower == Approx(sorted[size_t(lower_b * sorted.size())]).margin(level / 4));
+        REQUIRE(upper == Approx(sorted[size_t(upper_b * sorted.size())]).margin(level / 4));
+    }
+    SECTION("Merging sketches of tiles") {
+        QuantileSketch<float> top;
+        QuantileSketch<float> bottom;
+        top.Insert(ArrayView<const float>(chan).Region(0, 0, 400, 100));
+        bottom.Insert(ArrayView<const float>(chan).Region(0, 100, 400, 150));
+        top.Merge(bottom);
+        REQUIRE(top.GetCount() == chan.size());
+        auto [lower, upper] = top.Percentile(0.05f, 0.95f);
+        REQUIRE(std::abs(rank_of(lower) - 0.05) <= top.GetNormalizedRankError(0.05));
+        REQUIRE(std::abs(rank_of(upper) - 0.95) <= top.GetNormalizedRankError(0.95));
+    }
+    SECTION("Results do not depend on the number of threads") {
+        ParallelSettings settings;
+        settings.num_threads = GENERATE(1, 4);
+        settings.serial_threshold = 0;
+        settings.chunk_bytes = 4096;
+        ScopedParallelSettings scoped_settings(settings);
+        auto parallel = MakeQuantileSketch(ArrayView<float>(chan));
+        settings.num_threads = 3;
+        SetParallelSettings(settings);
+        REQUIRE(parallel.Percentile(0.1f, 0.9f) ==
+                MakeQuantileSketch(ArrayView<float>(chan)).Percentile(0.1f, 0.9f));
+    }
+}
+
+TEST_CASE(
+    "Contrast-limited adaptive histogram equalization"
+    "[ops][Channel]") {
+    Channel<float> chan(97, 61);
+    for (int y = 0; y != chan.GetHeight(); ++y) {
+        for (int x = 0; x != chan.GetWidth(); ++x) {
+            // A dark half and a bright half with fine details
+            int detail = (x * 7 + y * 3) % 97;
+            chan[y * chan.GetWidth() + x] = x < 48 ? float(detail % 5) : 4.0f + detail;
+        }
+    }
+    auto at = [](const Channel<float>& src, int x, int y) { return src[y * src.GetWidth() + x]; };
+    ops::CLAHESettings clahe;
+    clahe.tiles_x = 4;
+    clahe.tiles_y = 3;
+    clahe.clip_limit = 1000.0f;
+    Channel<float> serial(chan);
+    ops::EqualizeAdaptive(serial, 0.0f, 100.0f, clahe);
+    REQUIRE(Min(serial)[0] >= 0.0f);
+    REQUIRE(Max(serial)[0] <= 100.0f);
+    SECTION("Equal values are mapped by their neighbourhoods") {
+        // 4 is the maximum of the dark half and the minimum of the bright one
+        for (int y = 0; y != chan.GetHeight(); ++y) {
+            for (int x = 0; x != chan.GetWidth(); ++x) {
+                if (at(chan, x, y) == 4.0f && x < 20) {
+                    REQUIRE(at(serial, x, y) > 90.0f);
+                } else if (at(chan, x, y) == 4.0f && x > 60) {
+                    REQUIRE(at(serial, x, y) < 10.0f);
+                }
+            }
+        }
+    }
+    SECTION("Clipping limits the contrast enhancement") {
+        clahe.clip_limit = 1.0f;
+        Channel<float> clipped(chan);
+        ops::EqualizeAdaptive(clipped, 0.0f, 100.0f, clahe);
+        for (size_t i = 0; i != chan.size(); ++i) {
+            REQUIRE(clipped[i] == Approx(chan[i]).margin(5.0f));
+        }
+    }
+    SECTION("Results do not depend on the number of threads") {
+        ParallelSettings settings;
+        settings.num_threads = 4;
+        settings.serial_threshold = 0;
+        settings.chunk_bytes = 256;
+        ScopedParallelSettings scoped_settings(settings);
+        Channel<float> parallel(chan);
+        ops::EqualizeAdaptive(parallel, 0.0f, 100.0f, clahe);
+        REQUIRE(std::equal(parallel.begin(), parallel.end(), serial.begin()));
+    }
+    SECTION("Lab images") {
+        Image<float> lab(ColorSpace::Lab, 97, 61, 3);
+        lab.Fill(0.0f);
+        LoadFromChannel(lab, chan, 0);
+        Image<float> xyz = ops::GetEqualizedXYZFromLab(lab, ops::Equalization::Adaptive, clahe);
+        REQUIRE(xyz.GetColorSpace() == ColorSpace::XYZ);
+        xyz.ChangeColorSpace(ColorSpace::Lab);
+        REQUIRE(xyz[0] == Approx(serial[0]).margin(0.01f));
+    }
+}
+
+TEST_CASE(
+    "Cache of FFT plans"
+    "[FFT][ops][Channel]") {
+    Channel<float> chan(24, 14);
+    for (size_t i = 0; i != chan.size(); ++i) {
+        chan[i] = float(i % 7) + 0.5f * float(i % 3);
+    }
+    ClearPlanCache();
+    REQUIRE(GetNumOfCachedPlans() == 0);
+    Channel<float> first = ops::ApplyGaussianBlur(chan, 2, ops::BlurBackend::FFT);
+    // The forward and the backward transform of the padded size
+    REQUIRE(GetNumOfCachedPlans() == 2);
+    Channel<float> second = ops::ApplyGaussianBlur(chan, 2, ops::BlurBackend::FFT);
+    REQUIRE(GetNumOfCachedPlans() == 2);
+    REQUIRE(std::equal(first.begin(), first.end(), second.begin()));
+    SECTION("Planner rigor") {
+        const PlanRigor saved = GetPlanRigor();
+        SetPlanRigor(PlanRigor::Measure);
+        Channel<float> measured = ops::ApplyGaussianBlur(chan, 2, ops::BlurBackend::FFT);
+        SetPlanRigor(saved);
+        REQUIRE(GetNumOfCachedPlans() == 4);
+        for (size_t i = 0; i != chan.size(); ++i) {
+            REQUIRE(measured[i] == Approx(first[i]).margin(1e-4));
+        }
+    }
+    SECTION("Wisdom") {
+        const std::string filename = "pg_tests.wisdom";
+        {
+            WisdomFile wisdom(filename);
+        }
+        REQUIRE(ImportWisdom(filename));
+        REQUIRE(ExportWisdom(filename));
+        std::remove(filename.c_str());
+        REQUIRE_FALSE(ImportWisdom(filename));
+    }
+}
+
+TEST_CASE(
+    "Cached Gaussian filter response"
+    "[FFT][ops][Channel]") {
+    Channel<float> chan(21, 13);
+    for (size_t i = 0; i != chan.size(); ++i) {
+        chan[i] = std::cos(0.3f * i) + 1.0f;
+    }
+    int scale_parameter = GENERATE(1, 2);
+    // The filter built from the spatial kernel for every call; the padded width 41 is extended
+    // to 42 = 2 * 3 * 7
+    Channel<float> padded = ops::PadReflect(chan, 10, 6, 11, 6);
+    Channel<float> kernel = ops::MakeDistMap(padded);
+    for (auto& value : kernel) {
+        float arg = value * scale_parameter / 21;
+        value = std::exp(-arg * arg);
+    }
+    FFTr2c filter(kernel.begin(), kernel.GetWidth(), kernel.GetHeight());
+    filter.ForwardTransform();
+    filter.ReduceImagine();
+    filter.ClipNegativeOutRealToZero();
+    filter.RemoveOutZeroFreq();
+    FFTr2c data(padded.begin(), padded.GetWidth(), padded.GetHeight());
+    data.ForwardTransform();
+    data.MultiplyOutByRealOut(filter);
+    data.InverseTransform();
+    Channel<float> expected = Crop(padded, 10, 6, 21, 13);
+    Channel<float> first = ops::ApplyGaussianBlur(chan, scale_parameter, ops::BlurBackend::FFT);
+    for (size_t i = 0; i != first.size(); ++i) {
+        REQUIRE(first[i] == Approx(expected[i]).margin(1e-6));
+    }
+    // The second call uses the cached filter
+    Channel<float> second = ops::ApplyGaussianBlur(chan, scale_parameter, ops::BlurBackend::FFT);
+    REQUIRE(std::equal(second.begin(), second.end(), first.begin()));
+}
+
+TEST_CASE(
+    "Gaussian blur with DCT"
+    "[FFT][ops][Channel]") {
+    Channel<float> chan(40, 26);
+    for (int y = 0; y != chan.GetHeight(); ++y) {
+        for (int x = 0; x != chan.GetWidth(); ++x) {
+            chan[y * chan.GetWidth() + x] = 1.0f + 0.5f * std::sin(0.2f * x) * std::cos(0.3f * y);
+        }
+    }
+    SECTION("Constants are kept") {
+        Channel<float> constant(chan.GetWidth(), chan.GetHeight());
+        constant.Fill(3.0f);
+        Channel<float> blurred = ops::ApplyGaussianBlurDCT(constant);
+        for (float value : blurred) {
+            REQUIRE(value == Approx(3.0f).margin(1e-5));
+        }
+    }
+    SECTION("Blur equals the convolution with reflected borders") {
+        const int width = chan.GetWidth();
+        const int height = chan.GetHeight();
+        int scale_parameter = GENERATE(2, 8);
+        Channel<float> dct = ops::ApplyGaussianBlurDCT(chan, scale_parameter);
+        auto reflect = [](int i, int n) {
+            while (i < 0 || i >= n) {
+                i = i < 0 ? -i - 1 : 2 * n - 1 - i;
+            }
+            return i;
+        };
+        const double radius = double(width) / scale_parameter;
+        for (int y = 0; y < height; y += 5) {
+            for (int x = 0; x < width; x += 3) {
+                double sum = 0.0;
+                double weights = 0.0;
+                for (int dy = -3 * width; dy <= 3 * width; ++dy) {
+                    for (int dx = -3 * width; dx <= 3 * width; ++dx) {
+                        double weight = std::exp(-(dx * dx + dy * dy) / (radius * radius));
+                        int i = reflect(y + dy, height) * width + reflect(x + dx, width);
+                        sum += weight * chan[i];
+                        weights += weight;
+                    }
+                }
+                REQUIRE(dct[y * width + x] == Approx(sum / weights).margin(1e-4));
+            }
+        }
+    }
+}
+
+TEST_CASE(
+    "Recursive Gaussian blur"
+    "[ops][Channel]") {
+    Channel<float> chan(90, 57);
+    for (int y = 0; y != chan.GetHeight(); ++y) {
+        for (int x = 0; x != chan.GetWidth(); ++x) {
+            chan[y * chan.GetWidth() + x] =
+                1.0f + 0.5f * std::sin(0.15f * x) * std::cos(0.2f * y) + (x > 40 ? 0.5f : 0.0f);
+        }
+    }
+    SECTION("Constants are kept") {
+        Channel<float> constant(chan.GetWidth(), chan.GetHeight());
+        constant.Fill(3.0f);
+        Channel<float> blurred = ops::ApplyGaussianBlurRecursive(constant, 8);
+        for (float value : blurred) {
+            REQUIRE(value == Approx(3.0f).margin(1e-4));
+        }
+    }
+    SECTION("Blur is close to the one of DCT") {
+        int scale_parameter = GENERATE(2, 8, 20);
+        Channel<float> recursive = ops::ApplyGaussianBlurRecursive(chan, scale_parameter);
+        Channel<float> dct = ops::ApplyGaussianBlurDCT(chan, scale_parameter);
+        for (size_t i = 0; i != chan.size(); ++i) {
+            REQUIRE(recursive[i] == Approx(dct[i]).margin(0.01));
+        }
+    }
+    SECTION("Narrow kernels") {
+        REQUIRE_THROWS(ops::ApplyGaussianBlurRecursive(chan, 200));
+    }
+    SECTION("Automatic choice of the backend") {
+        // The standard deviation 90 / (8 * sqrt(2)) ~ 8 pixels is less than 57 / 6
+        Channel<float> narrow = ops::ApplyGaussianBlur(chan, 8);
+        Channel<float> recursive = ops::ApplyGaussianBlurRecursive(chan, 8);
+        REQUIRE(std::equal(narrow.begin(), narrow.end(), recursive.begin()));
+        Channel<float> wide = ops::ApplyGaussianBlur(chan, 2);
+        Channel<float> dct = ops::ApplyGaussianBlurDCT(chan, 2);
+        REQUIRE(std::equal(wide.begin(), wide.end(), dct.begin()));
+    }
+}
+
+TEST_CASE(
+    "Batched and multi-threaded Fourier transforms"
+    "[FFT][ops][Image]") {
+    Layout layout = GENERATE(Layout::Interleaved, Layout::Planar);
+    Image<float> img(ColorSpace::XYZ, layout, 26, 17, 3);
+    for (int channel = 0; channel != 3; ++channel) {
+        Channel<float> chan(img.GetWidth(), img.GetHeight());
+        for (size_t i = 0; i != chan.size(); ++i) {
+            chan[i] = std::cos(0.2f * i * (channel + 1)) + float(channel);
+        }
+        LoadFromChannel(img, chan, channel);
+    }
+    SECTION("A batch equals transforms of single channels") {
+        Image<float> blurred = ops::ApplyGaussianBlur(img, 2, ops::BlurBackend::FFT);
+        REQUIRE(blurred.GetLayout() == layout);
+        for (int channel = 0; channel != 3; ++channel) {
+            Channel<float> expected =
+                ops::ApplyGaussianBlur(CopyChannel(img, channel), 2, ops::BlurBackend::FFT);
+            Channel<float> actual = CopyChannel(blurred, channel);
+            for (size_t i = 0; i != expected.size(); ++i) {
+                REQUIRE(actual[i] == Approx(expected[i]).margin(1e-5));
+            }
+        }
+    }
+    SECTION("Other backends blur channels one by one") {
+        Image<float> blurred = ops::ApplyGaussianBlur(img, 8);
+        Channel<float> expected = ops::ApplyGaussianBlur(CopyChannel(img, 1), 8);
+        Channel<float> actual = CopyChannel(blurred, 1);
+        REQUIRE(std::equal(actual.begin(), actual.end(), expected.begin()));
+    }
+    SECTION("Threads do not change results") {
+        Image<float> threaded = ops::ApplyGaussianBlur(img, 2, ops::BlurBackend::FFT);
+        SetMultiThreadedFFT(false);
+        REQUIRE_FALSE(IsMultiThreadedFFT());
+        Image<float> serial = ops::ApplyGaussianBlur(img, 2, ops::BlurBackend::FFT);
+        SetMultiThreadedFFT(true);
+        for (size_t i = 0; i != img.size(); ++i) {
+            REQUIRE(threaded[i] == Approx(serial[i]).margin(1e-5));
+        }
+    }
+    SECTION("Round trip of a batch") {
+        Image<float> planes(img);
+        planes.ChangeLayout(Layout::Planar);
+        FFTr2c batch(planes);
+        batch.ForwardTransform();
+        batch.InverseTransform();
+        Image<float> restored(planes);
+        restored.Fill(0.0f);
+        batch.LoadTo(restored);
+        for (size_t i = 0; i != planes.size(); ++i) {
+            REQUIRE(restored[i] == Approx(planes[i]).margin(1e-4));
+        }
+    }
+}
+
+TEST_CASE(
+    "FFT-friendly padding"
+    "[FFT][ops][Channel]") {
+    SECTION("Sizes") {
+        REQUIRE(GetFastFFTSize(1) == 1);
+        REQUIRE(GetFastFFTSize(11) == 12);
+        REQUIRE(GetFastFFTSize(41) == 42);
+        REQUIRE(GetFastFFTSize(127) == 128);
+        REQUIRE(GetFastFFTSize(1031) == 1050);
+        REQUIRE(GetFastFFTSize(2401) == 2401);
+    }
+    Channel<float> chan(7, 4);
+    for (size_t i = 0; i != chan.size(); ++i) {
+        chan[i] = float(i);
+    }
+    SECTION("Asymmetric reflected fields") {
+        Channel<float> padded = ops::PadReflect(chan, 2, 1, 3, 5);
+        REQUIRE(padded.GetWidth() == 12);
+        REQUIRE(padded.GetHeight() == 10);
+        // Reflection about the border pixels: the row 1 of the channel is above the row 0
+        REQUIRE(padded[0 * 12 + 2] == chan[1 * 7 + 0]);
+        REQUIRE(padded[1 * 12 + 0] == chan[0 * 7 + 2]);
+        REQUIRE(padded[1 * 12 + 11] == chan[0 * 7 + 3]);
+        // The field of 5 rows below 4 rows is reflected twice
+        REQUIRE(padded[9 * 12 + 2] == chan[2 * 7 + 0]);
+        Channel<float> symmetric = ops::PadReflect(chan, 3, 2);
+        Channel<float> general = ops::PadReflect(chan, 3, 2, 3, 2);
+        REQUIRE(std::equal(symmetric.begin(), symmetric.end(), general.begin()));
+        Channel<float> cropped = Crop(padded, 2, 1, 7, 4);
+        REQUIRE(std::equal(cropped.begin(), cropped.end(), chan.begin()));
+    }
+    SECTION("Channels padded to the same size") {
+        // Widths 19 and 20 are padded to 40 but have different kernels
+        Channel<float> narrower(19, 7);
+        Channel<float> wider(20, 7);
+        for (size_t i = 0; i != wider.size(); ++i) {
+            wider[i] = std::cos(0.5f * i);
+        }
+        Channel<float> padded = ops::PadReflect(wider, 10, 3, 10, 4);
+        Channel<float> kernel = ops::MakeDistMap(padded);
+        for (auto& value : kernel) {
+            float arg = value * 2 / 20;
+            value = std::exp(-arg * arg);
+        }
+        FFTr2c filter(kernel.begin(), kernel.GetWidth(), kernel.GetHeight());
+        filter.ForwardTransform();
+        filter.ReduceImagine();
+        filter.ClipNegativeOutRealToZero();
+        filter.RemoveOutZeroFreq();
+        FFTr2c data(padded.begin(), padded.GetWidth(), padded.GetHeight());
+        data.ForwardTransform();
+        data.MultiplyOutByRealOut(filter);
+        data.InverseTransform();
+        Channel<float> expected = Crop(padded, 10, 3, 20, 7);
+        narrower.Fill(1.0f);
+        ops::ApplyGaussianBlur(narrower, 2, ops::BlurBackend::FFT);
+        Channel<float> blurred = ops::ApplyGaussianBlur(wider, 2, ops::BlurBackend::FFT);
+        for (size_t i = 0; i != blurred.size(); ++i) {
+            REQUIRE(blurred[i] == Approx(expected[i]).margin(1e-6));
+        }
+    }
+}
+
+TEST_CASE(
+    "Tiled convolution"
+    "[FFT][ops][Channel]") {
+    Channel<float> chan(53, 38);
+    for (int y = 0; y != chan.GetHeight(); ++y) {
+        for (int x = 0; x != chan.GetWidth(); ++x) {
+            chan[y * chan.GetWidth() + x] =
+                1.0f + 0.5f * std::sin(0.3f * x) * std::cos(0.2f * y) + (x > 30 ? 0.5f : 0.0f);
+        }
+    }
+    SECTION("Tiles equal the direct convolution") {
+        // Kernels narrower and wider than the channel, which is reflected several times
+        const int radius = GENERATE(4, 60);
+        std::vector<float> kernel(2 * radius + 1);
+        for (size_t i = 0; i != kernel.size(); ++i) {
+            kernel[i] = float(i % 5) + 1.0f;
+        }
+        Channel<float> padded = ops::PadReflect(chan, radius, radius);
+        int tile_size = GENERATE(7, 16, 100);
+        Channel<float> tiled(chan.GetWidth(), chan.GetHeight());
+        ConvolveTiled(chan.begin(), tiled.begin(), chan.GetWidth(), chan.GetHeight(), kernel,
+                      radius, tile_size);
+        Channel<float> in_place(chan);
+        ConvolveTiled(in_place.begin(), in_place.begin(), chan.GetWidth(), chan.GetHeight(),
+                      kernel, radius, tile_size);
+        for (int y = 0; y != chan.GetHeight(); ++y) {
+            for (int x = 0; x != chan.GetWidth(); ++x) {
+                double sum = 0.0;
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    for (int dx = -radius; dx <= radius; ++dx) {
+                        int i = (y + radius - dy) * padded.GetWidth() + x + radius - dx;
+                        sum += double(kernel[dy + radius]) * kernel[dx + radius] * padded[i];
+                    }
+                }
+                REQUIRE(tiled[y * chan.GetWidth() + x] == Approx(sum).epsilon(1e-4));
+                REQUIRE(in_place[y * chan.GetWidth() + x] == tiled[y * chan.GetWidth() + x]);
+            }
+        }
+    }
+    SECTION("Gaussian blur of tiles") {
+        // The standard deviation 53 / (12 * sqrt(2)) ~ 3 pixels
+        Channel<float> tiled = ops::ApplyGaussianBlurTiled(chan, 12, 16);
+        Channel<float> dct = ops::ApplyGaussianBlurDCT(chan, 12);
+        for (int y = 8; y != chan.GetHeight() - 8; ++y) {
+            for (int x = 8; x != chan.GetWidth() - 8; ++x) {
+                int i = y * chan.GetWidth() + x;
+                REQUIRE(tiled[i] == Approx(dct[i]).margin(1e-3));
+            }
+        }
+        Channel<float> selected = ops::ApplyGaussianBlur(chan, 12, ops::BlurBackend::Tiled);
+        REQUIRE(selected[0] == Approx(ops::ApplyGaussianBlurTiled(chan, 12)[0]));
+    }
+}
+
+TEST_CASE(
+    "Qualities of local lightness adaptation"
+    "[ops][Image]") {
+    Image<float> xyz(ColorSpace::XYZ, 150, 140, 3);
+    for (int y = 0; y != xyz.GetHeight(); ++y) {
+        for (int x = 0; x != xyz.GetWidth(); ++x) {
+            float luminance = x < 75 ? 0.1f : 0.9f;
+            for (int c = 0; c != 3; ++c) {
+                xyz[(size_t(y) * xyz.GetWidth() + x) * 3 + c] = luminance * (0.9f + 0.05f * c);
+            }
+        }
+    }
+    Image<float> preview = ops::LocLightAdapt(xyz);
+    Image<float> full = ops::LocLightAdapt(xyz, ops::AdaptationQuality::Full);
+    REQUIRE(full.GetColorSpace() == ColorSpace::XYZ);
+    REQUIRE(AreEqualDimensions(full, xyz));
+    // The maps differ only by the resolution of the blur
+    for (size_t i = 0; i != xyz.size(); ++i) {
+        REQUIRE(full[i] == Approx(preview[i]).epsilon(0.05));
+    }
+}
+
+TEST_CASE(
+    "Low-resolution adaptation maps"
+    "[ops][Image]") {
+    Image<float> lms(ColorSpace::LMS, 50, 40, 3);
+    for (size_t i = 0; i != lms.size(); ++i) {
+        lms[i] = float(i % 17) - 3.0f;
+    }
+    Channel<float> adapt(5, 4);
+    Channel<float> white(5, 4);
+    for (size_t i = 0; i != adapt.size(); ++i) {
+        adapt[i] = 0.5f + 0.1f * float(i);
+        white[i] = 2.0f + float(i % 3);
+    }
+    // Bilinear interpolation with aligned sample centres
+    auto upsample = [&lms](const Channel<float>& map) {
+        Channel<float> result(lms.GetWidth(), lms.GetHeight());
+        auto position = [](int i, int src_size, int dst_size) {
+            return std::clamp((i + 0.5) * src_size / dst_size - 0.5, 0.0, src_size - 1.0);
+        };
+        for (int y = 0; y != result.GetHeight(); ++y) {
+            double pos_y = position(y, map.GetHeight(), result.GetHeight());
+            int y0 = int(pos_y);
+            int y1 = std::min(y0 + 1, map.GetHeight() - 1);
+            for (int x = 0; x != result.GetWidth(); ++x) {
+                double pos_x = position(x, map.GetWidth(), result.GetWidth());
+                int x0 = int(pos_x);
+                int x1 = std::min(x0 + 1, map.GetWidth() - 1);
+                auto at = [&map](int x, int y) { return map[size_t(y) * map.GetWidth() + x]; };
+                double top = at(x0, y0) + (pos_x - x0) * (at(x1, y0) - at(x0, y0));
+                double bottom = at(x0, y1) + (pos_x - x0) * (at(x1, y1) - at(x0, y1));
+                float value = float(top + (pos_y - y0) * (bottom - top));
+                result[size_t(y) * result.GetWidth() + x] = value;
+            }
+        }
+        return result;
+    };
+    Image<float> low = ops::CAMCompress(lms, adapt, white, 0.7f);
+    Image<float> full = ops::CAMCompress(lms, upsample(adapt), upsample(white), 0.7f);
+    REQUIRE(AreEqualDimensions(low, lms));
+    for (size_t i = 0; i != lms.size(); ++i) {
+        REQUIRE(low[i] == Approx(full[i]).epsilon(1e-4).margin(1e-4));
+    }
+    REQUIRE_THROWS(ops::CAMCompress(lms, adapt, Channel<float>(4, 4), 0.7f));
+}
+
+TEST_CASE(
+    "Fused local lightness adaptation"
+    "[ops][Image]") {
+    for (Layout layout : {Layout::Interleaved, Layout::Planar}) {
+        Image<float> xyz(ColorSpace::XYZ, layout, 60, 45, 3);
+        for (int channel = 0; channel != 3; ++channel) {
+            ArrayView<float> view = ChannelView(xyz, channel);
+            for (int y = 0; y != xyz.GetHeight(); ++y) {
+                for (int x = 0; x != xyz.GetWidth(); ++x) {
+                    view.At(x, y) = 0.05f + 0.01f * float((x * 7 + y * 3 + channel) % 50);
+                }
+            }
+        }
+        // The passes fused by LocLightAdapt()
+        const float scale = 16250.0f / Max(ChannelView(xyz, 1))[0];
+        Channel<float> white = CopyChannel(xyz, 1);
+        white *= scale;
+        white = ops::ApplyGaussianBlurTiled(white);
+        Image<float> expected(ColorSpace::XYZ, layout, xyz.GetWidth(), xyz.GetHeight(), 3);
+        expected = xyz * scale;
+        expected.ChangeColorSpace(ColorSpace::LMS);
+        expected = ops::CAMCompress(expected, ops::GetAdaptMatrix(white), white, 0.7f);
+        expected.ChangeColorSpace(ColorSpace::XYZ);
+
+        Image<float> result = ops::LocLightAdapt(xyz, ops::AdaptationQuality::Full);
+        REQUIRE(result.GetLayout() == layout);
+        for (size_t i = 0; i != xyz.size(); ++i) {
+            REQUIRE(result[i] == Approx(expected[i]).epsilon(1e-4).margin(1e-3));
+        }
+    }
+}
+
+TEST_CASE(
+    "Fused IPT adaptation"
+    "[ops][Image]") {
+    for (Layout layout : {Layout::Interleaved, Layout::Planar}) {
+        Image<float> xyz(ColorSpace::XYZ, layout, 45, 30, 3);
+        for (int channel = 0; channel != 3; ++channel) {
+            ArrayView<float> view = ChannelView(xyz, channel);
+            for (int y = 0; y != xyz.GetHeight(); ++y) {
+                for (int x = 0; x != xyz.GetWidth(); ++x) {
+                    view.At(x, y) = 0.02f + 0.01f * float((x * 5 + y * 11 + channel * 3) % 70);
+                }
+            }
+        }
+        // The passes fused by IPTAdapt()
+        Image<float> expected(ColorSpace::XYZ, layout, xyz.GetWidth(), xyz.GetHeight(), 3);
+        expected = xyz * (16250.0f / Max(ChannelView(xyz, 1))[0]);
+        Channel<float> FL = ops::GetAdaptMatrix(CopyChannel(expected, 1));
+        expected.ChangeColorSpace(ColorSpace::LMS);
+        expected = Pow(Abs(expected), 0.43f);
+        expected.ChangeColorSpace(ColorSpace::IPT);
+        ArrayView<float> P = ChannelView(expected, 1);
+        ArrayView<float> T = ChannelView(expected, 2);
+        for (int y = 0; y != xyz.GetHeight(); ++y) {
+            for (int x = 0; x != xyz.GetWidth(); ++x) {
+                float c_val = std::sqrt(P.At(x, y) * P.At(x, y) + T.At(x, y) * T.At(x, y));
+                c_val = (1.29f * c_val * c_val - 0.27f * c_val + 0.42f) /
+                        (c_val * c_val - 0.31f * c_val + 0.42f);
+                float factor = std::pow(FL[size_t(y) * xyz.GetWidth() + x] + 1, 0.15f) * c_val;
+                P.At(x, y) *= factor;
+                T.At(x, y) *= factor;
+            }
+        }
+        expected.ChangeColorSpace(ColorSpace::LMS);
+        expected = Pow(Abs(expected), 1.0f / 0.43f);
+        expected.ChangeColorSpace(ColorSpace::XYZ);
+        expected /= Max(ChannelView(expected, 1))[0];
+
+        Image<float> result = ops::IPTAdapt(xyz);
+        REQUIRE(result.GetLayout() == layout);
+        REQUIRE(Max(ChannelView(result, 1))[0] == Approx(1.0f));
+        for (size_t i = 0; i != xyz.size(); ++i) {
+            REQUIRE(result[i] == Approx(expected[i]).epsilon(1e-4).margin(1e-5));
+        }
+    }
+}
+
+TEST_CASE(
+    "Tabulated response curves"
+    "[ops][Image]") {
+    for (float exponent : {0.42f, 0.43f, 0.7f, 1.0f / 0.7f, 1.0f / 0.43f}) {
+        PowTable power(exponent);
+        const double bound = std::abs(exponent * (exponent - 1.0)) / 8.0 / (1 << 20) + 1e-6;
+        REQUIRE(power(0.0f) == 0.0f);
+        for (float x = 1e-20f; x < 1e20f; x *= 1.0137f) {
+            double exact = std::pow(double(x), double(exponent));
+            if (exact > 1e-37 && exact < 1e37) {
+                REQUIRE(std::abs(power(x) - exact) <= bound * exact);
+            }
+        }
+    }
+
+    Image<float> lms(ColorSpace::LMS, 40, 30, 3);
+    for (size_t i = 0; i != lms.size(); ++i) {
+        lms[i] = (float(i % 23) - 5.0f) * std::pow(10.0f, float(i % 7) - 3.0f);
+    }
+    Channel<float> adapt(40, 30);
+    Channel<float> white(40, 30);
+    adapt.Fill(0.8f);
+    white.Fill(3.0f);
+    using ops::CurveEvaluation;
+    REQUIRE(ops::GetCurveEvaluation() == CurveEvaluation::Exact);
+    Image<float> exact = ops::CAMCompress(lms, adapt, white, 0.7f, CurveEvaluation::Exact);
+    Image<float> tabulated = ops::CAMCompress(lms, adapt, white, 0.7f, CurveEvaluation::Tabulated);
+    ops::SetCurveEvaluation(CurveEvaluation::Tabulated);
+    Image<float> by_default = ops::CAMCompress(lms, adapt, white, 0.7f);
+    ops::SetCurveEvaluation(CurveEvaluation::Exact);
+    for (size_t i = 0; i != lms.size(); ++i) {
+        REQUIRE(tabulated[i] == Approx(exact[i]).epsilon(1e-5).margin(1e-5));
+        REQUIRE(by_default[i] == tabulated[i]);
+    }
+    Image<float> restored = ops::CAMDecompress(exact, 0.7f, CurveEvaluation::Exact);
+    Image<float> tabulated_restored = ops::CAMDecompress(exact, 0.7f, CurveEvaluation::Tabulated);
+    for (size_t i = 0; i != lms.size(); ++i) {
+        REQUIRE(tabulated_restored[i] == Approx(restored[i]).epsilon(1e-5).margin(1e-6));
+    }
+    REQUIRE_THROWS(ops::SetCurveEvaluation(CurveEvaluation::Default));
+}
+
+TEST_CASE(
+    "Accuracy tiers of math functions"
+    "[math][Channel]") {
+    using math::Accuracy;
+    REQUIRE(math::GetAccuracy() == Accuracy::Exact);
+    for (auto [accuracy, bound] :
+         {std::pair(Accuracy::High, 1e-6), std::pair(Accuracy::Fast, 1e-4)}) {
+        auto relative_error = [](double value, double exact) {
+            return std::abs(value - exact) / std::abs(exact);
+        };
+        for (float x = -87.0f; x < 88.0f; x += 0.0173f) {
+            REQUIRE(relative_error(math::Exp(x, accuracy), std::exp(double(x))) < bound);
+        }
+        REQUIRE(math::Exp(-100.0f, accuracy) == 0.0f);
+        for (float x = 1e-37f; x < 1e37f; x *= 1.0173f) {
+            if (x != 1.0f) {
+                REQUIRE(relative_error(math::Log(x, accuracy), std::log(double(x))) < bound);
+            }
+            REQUIRE(relative_error(math::Cbrt(-x, accuracy), -std::cbrt(double(x))) < bound);
+            for (float y : {0.15f, 0.43f, 1.0f / 2.4f, 1.0f / 0.43f, 3.0f}) {
+                double exact = std::pow(double(x), double(y));
+                if (exact > 1e-37 && exact < 1e37) {
+                    REQUIRE(relative_error(math::Pow(x, y, accuracy), exact) < bound);
+                }
+            }
+        }
+        REQUIRE(math::Pow(0.0f, 0.43f, accuracy) == 0.0f);
+        REQUIRE(math::Cbrt(0.0f, accuracy) == 0.0f);
+    }
+
+    // Expressions use the library-wide accuracy
+    Channel<float> src(100, 10);
+    for (size_t i = 0; i != src.size(); ++i) {
+        src[i] = 0.01f * float(i + 1);
+    }
+    Channel<float> exact(100, 10);
+    Channel<float> fast(100, 10);
+    exact = Pow(src, 0.43f) + Cbrt(src);
+    math::SetAccuracy(Accuracy::Fast);
+    REQUIRE(math::GetAccuracy() == Accuracy::Fast);
+    fast = Pow(src, 0.43f) + Cbrt(src);
+    math::SetAccuracy(Accuracy::Exact);
+    bool differs = false;
+    for (size_t i = 0; i != src.size(); ++i) {
+        REQUIRE(exact[i] == Approx(std::pow(src[i], 0.43f) + std::cbrt(src[i])));
+        REQUIRE(fast[i] == Approx(exact[i]).epsilon(1e-4));
+        differs = differs || fast[i] != exact[i];
+    }
+    REQUIRE(differs);
+
+    // So do Lab conversions
+    Image<float> xyz(ColorSpace::XYZ, 40, 10, 3);
+    for (size_t i = 0; i != xyz.size(); ++i) {
+        xyz[i] = 0.002f * float(i + 1);
+    }
+    Image<float> exact_lab(xyz, ColorSpace::Lab);
+    math::SetAccuracy(Accuracy::Fast);
+    Image<float> fast_lab(xyz, ColorSpace::Lab);
+    math::SetAccuracy(Accuracy::Exact);
+    for (size_t i = 0; i != xyz.size(); ++i) {
+        REQUIRE(fast_lab[i] == Approx(exact_lab[i]).margin(1e-2));
+    }
+}